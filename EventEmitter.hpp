@@ -5,437 +5,5602 @@
 #undef __EVENTEMITTER_PROVIDER
 #undef __EVENTEMITTER_PROVIDER_THREADED
 #undef __EVENTEMITTER_PROVIDER_DEFERRED
+#undef __EVENTEMITTER_PROVIDER_STATIC
+#undef __EVENTEMITTER_PROVIDER_STICKY
+#undef __EVENTEMITTER_PROVIDER_STICKY_THREADED
+#undef __EVENTEMITTER_PROVIDER_SHARED
+#undef __EVENTEMITTER_PROVIDER_LOCKED
+#undef __EVENTEMITTER_DISPATCHER
+#undef __EVENTEMITTER_DISPATCHER_DEFERRED
 #endif
 
 #include <functional>
 #include <forward_list>
 #include <map>
+#include <unordered_map>
 #include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <exception>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <array>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define __EVENTEMITTER_HAS_COROUTINES
+#endif
+#endif
 
 #ifndef EVENTEMITTER_DISABLE_THREADING
 #include <condition_variable>
 #include <future>
+#include <thread>
 #include <mutex>
+#include <shared_mutex>
+
+#define __EVENTEMITTER_MUTEX_DECLARE(name) std::mutex name;
+#define __EVENTEMITTER_LOCK_GUARD(lockable) std::lock_guard<std::mutex> guard(lockable);
+#else
+#define __EVENTEMITTER_MUTEX_DECLARE(name);
+#define __EVENTEMITTER_LOCK_GUARD(lockable);
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <csignal>
+#include <pthread.h>
+#include <unistd.h>
+#define __EVENTEMITTER_HAS_EVENTFD
+
+#include <chrono>
+#include <climits>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#define __EVENTEMITTER_HAS_SHM
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#define __EVENTEMITTER_HAS_EVENTLOG
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+#include <pthread.h>
+#include <sched.h>
+#define __EVENTEMITTER_HAS_AFFINITY
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define __EVENTEMITTER_GCC_WORKAROUND this->
+#define __EVENTEMITTER_LOAD_ACQUIRE(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define __EVENTEMITTER_STORE_RELEASE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#else
+#define __EVENTEMITTER_GCC_WORKAROUND
+#define __EVENTEMITTER_LOAD_ACQUIRE(var) (var)
+#define __EVENTEMITTER_STORE_RELEASE(var, value) ((var) = (value))
+#endif
+
+#define __EVENTEMITTER_CONCAT_IMPL(x, y) x ## y
+#define __EVENTEMITTER_CONCAT(x, y) __EVENTEMITTER_CONCAT_IMPL(x, y)
+
+#ifndef __EVENTEMITTER_CONTAINER
+#define __EVENTEMITTER_CONTAINER std::forward_list<HandlerPtr>
+#endif
+
+#ifndef __EVENTEMITTER_NONMACRO_DEFS
+#define __EVENTEMITTER_NONMACRO_DEFS
+using handle_id_type = uint32_t;
+
+namespace EE {
+	// Handlers and deferred events are ordered by priority band first and
+	// by registration (trigger) order within a band.
+	enum class Priority : uint8_t {
+		Critical,
+		High,
+		Normal,
+		Low
+	};
+	static const int PriorityBands = 4;
+
+	// A forward_list kept sorted by priority band, with O(1) insertion at
+	// the end of a band. tails[b] is the last node of bands <= b (or
+	// before_begin). Elements carry their band in a `band` member.
+	template<typename Container>
+	class BandedList : private Container {
+		typedef typename Container::iterator iterator;
+		iterator tails[PriorityBands];
+
+		void resetTails() {
+			for(auto& tail : tails) {
+				tail = Container::before_begin();
+			}
+		}
+		void rebuildTails() {
+			resetTails();
+			for(auto it = Container::begin();it != Container::end();++it) {
+				for(int b = it->band;b < PriorityBands;++b) {
+					tails[b] = it;
+				}
+			}
+		}
+	public:
+		using Container::begin;
+		using Container::end;
+		using Container::before_begin;
+		using Container::empty;
+		using Container::front;
+
+		BandedList() {
+			resetTails();
+		}
+		BandedList(const BandedList& other) : Container(other) {
+			rebuildTails();
+		}
+		BandedList(BandedList&& other) : Container(std::move(other)) {
+			rebuildTails();
+			other.resetTails();
+		}
+		BandedList& operator=(const BandedList& other) {
+			Container::operator=(other);
+			rebuildTails();
+			return *this;
+		}
+		BandedList& operator=(BandedList&& other) {
+			Container::operator=(std::move(other));
+			rebuildTails();
+			other.clear();
+			return *this;
+		}
+		template<typename... Args> iterator emplace(Priority priority, Args&&... fargs) {
+			int band = static_cast<int>(priority);
+			iterator pos = tails[band];
+			iterator it = Container::emplace_after(pos, std::forward<Args>(fargs)...);
+			it->band = band;
+			for(int b = band;b < PriorityBands && tails[b] == pos;++b) {
+				tails[b] = it;
+			}
+			return it;
+		}
+		iterator erase_after(iterator prev) {
+			iterator victim = std::next(prev);
+			for(auto& tail : tails) {
+				if(tail == victim) {
+					tail = prev;
+				}
+			}
+			return Container::erase_after(prev);
+		}
+		void pop_front() {
+			erase_after(Container::before_begin());
+		}
+		void clear() {
+			Container::clear();
+			resetTails();
+		}
+	};
+
+	// Budget of runDeferredN()/runDeferredFor(): Snapshot leaves what is
+	// queued during the drain to the next one.
+	enum class DrainMode : uint8_t {
+		UntilEmpty,
+		Snapshot
+	};
+	struct DrainResult {
+		size_t processed;
+		// work is left in the queue
+		bool more;
+	};
+
+	// Hashed timing wheel for calls due at a later time. A timer is rounded
+	// up to the next tick and linked into the slot of that tick; expire()
+	// walks the slots passed since its last call and hands out the timers
+	// that are due, leaving those a full turn or more ahead. Scheduling and
+	// cancelling are O(1), and expiry is O(1) per timer and turn it waits.
+	// Nodes live in one vector and are reused, handles carry a generation
+	// so that a stale one cancels nothing.
+	// TimerService is not used here: its heap suits the few long-lived,
+	// constantly rescheduled timers of the rate operators, each embedded in
+	// its operator and fired on the service thread. Deferred calls are
+	// one-shot, can number in the millions, own their payload and must run
+	// from the owner's queue, which the wheel serves without a thread.
+	template<typename Payload>
+	class TimerWheel {
+		static const uint32_t none = static_cast<uint32_t>(-1);
+		struct Node {
+			Payload payload;
+			uint64_t due;
+			uint32_t next, prev;
+			uint32_t slot;
+			// odd while scheduled
+			uint32_t generation;
+		};
+		struct Slot {
+			uint32_t head = none, tail = none;
+		};
+		std::vector<Node> nodes;
+		std::vector<Slot> slots;
+		uint32_t freeNodes = none;
+		// last tick expire() went through
+		uint64_t tick = 0;
+		size_t count = 0;
+		std::chrono::steady_clock::time_point origin;
+		std::chrono::steady_clock::duration resolution;
+
+		uint64_t ticksAt(std::chrono::steady_clock::time_point when, bool roundUp) const {
+			if(when <= origin) {
+				return 0;
+			}
+			auto elapsed = (when - origin).count();
+			auto step = resolution.count();
+			return static_cast<uint64_t>(roundUp ? (elapsed + step - 1) / step : elapsed / step);
+		}
+		void unlink(uint32_t index) {
+			Node& node = nodes[index];
+			Slot& slot = slots[node.slot];
+			(node.prev == none ? slot.head : nodes[node.prev].next) = node.next;
+			(node.next == none ? slot.tail : nodes[node.next].prev) = node.prev;
+		}
+		void release(uint32_t index) {
+			Node& node = nodes[index];
+			node.payload = Payload();
+			node.generation++;
+			node.next = freeNodes;
+			freeNodes = index;
+			count--;
+		}
+	public:
+		typedef uint64_t Handle;
+
+		TimerWheel(std::chrono::steady_clock::duration resolution = std::chrono::milliseconds(1), size_t size = 4096) : slots(size), origin(std::chrono::steady_clock::now()), resolution(resolution) {
+		}
+		size_t size() const {
+			return count;
+		}
+		// false when when is not past the last expiry, the caller should
+		// run payload right away instead
+		bool schedule(std::chrono::steady_clock::time_point when, Payload& payload, Handle& handle) {
+			uint64_t due = ticksAt(when, true);
+			if(due <= tick) {
+				return false;
+			}
+			uint32_t index = freeNodes;
+			if(index == none) {
+				index = static_cast<uint32_t>(nodes.size());
+				nodes.push_back(Node{Payload(), 0, none, none, 0, 0});
+			}
+			else {
+				freeNodes = nodes[index].next;
+			}
+			Node& node = nodes[index];
+			node.payload = std::move(payload);
+			node.due = due;
+			node.generation++;
+			node.slot = static_cast<uint32_t>(due % slots.size());
+			Slot& slot = slots[node.slot];
+			node.next = none;
+			node.prev = slot.tail;
+			(slot.tail == none ? slot.head : nodes[slot.tail].next) = index;
+			slot.tail = index;
+			count++;
+			handle = static_cast<Handle>(node.generation) << 32 | index;
+			return true;
+		}
+		// false when the timer already expired or was cancelled
+		bool cancel(Handle handle) {
+			uint32_t index = static_cast<uint32_t>(handle);
+			uint32_t generation = static_cast<uint32_t>(handle >> 32);
+			if(index >= nodes.size() || nodes[index].generation != generation || !(generation & 1)) {
+				return false;
+			}
+			unlink(index);
+			release(index);
+			return true;
+		}
+		// Calls ready(payload) for every timer due by now, slot by slot.
+		template<typename Ready> void expire(std::chrono::steady_clock::time_point now, Ready&& ready) {
+			uint64_t target = ticksAt(now, false);
+			if(target <= tick) {
+				return;
+			}
+			uint64_t steps = std::min<uint64_t>(target - tick, slots.size());
+			for(uint64_t step = 1;step <= steps && count;++step) {
+				Slot& slot = slots[(tick + step) % slots.size()];
+				for(uint32_t index = slot.head;index != none;) {
+					Node& node = nodes[index];
+					uint32_t next = node.next;
+					if(node.due <= target) {
+						unlink(index);
+						ready(node.payload);
+						release(index);
+					}
+					index = next;
+				}
+			}
+			tick = target;
+		}
+		// When the earliest timer is due, time_point::max() without any.
+		// Walks the slots ahead until one holds a timer due in this turn,
+		// a full turn when all are further away.
+		std::chrono::steady_clock::time_point next() const {
+			uint64_t earliest = UINT64_MAX;
+			for(uint64_t step = 1;step <= slots.size() && count;++step) {
+				const Slot& slot = slots[(tick + step) % slots.size()];
+				for(uint32_t index = slot.head;index != none;index = nodes[index].next) {
+					earliest = std::min(earliest, nodes[index].due);
+				}
+				if(earliest <= tick + step) {
+					break;
+				}
+			}
+			if(earliest == UINT64_MAX) {
+				return std::chrono::steady_clock::time_point::max();
+			}
+			return origin + resolution * static_cast<std::chrono::steady_clock::rep>(earliest);
+		}
+		void clear() {
+			for(auto& slot : slots) {
+				while(slot.head != none) {
+					uint32_t index = slot.head;
+					unlink(index);
+					release(index);
+				}
+			}
+		}
+	};
+
+	// Deferred queue shared by every deferred mixin of an object. All of
+	// its state lives in a block allocated on first use, so an object that
+	// never defers anything pays two pointers.
+	class DeferredBase {
+	public:
+		typedef uint64_t TimerHandle;
+		// A call embedded in the object that posts it, such as a coroutine
+		// waiting for events, so posting it does not allocate. Such calls
+		// run ahead of the queue, each is queued at most once at a time.
+		struct Resumable {
+			void (*run)(Resumable*) = nullptr;
+			Resumable* nextResumable = nullptr;
+			bool queued = false;
+		};
+	protected: 
+		typedef std::function<void ()> DeferredHandler;
+		struct DeferredItem {
+			DeferredHandler handler;
+			uint8_t band;
+			DeferredItem(DeferredHandler handler) : handler(std::move(handler)) {}
+		};
+		struct DelayedItem {
+			DeferredHandler handler;
+			Priority priority;
+		};
+		struct State {
+			BandedList<std::forward_list<DeferredItem>> queue;
+			Resumable* resumables = nullptr;
+			Resumable** resumablesTail = &resumables;
+			// both queues
+			size_t pending = 0;
+			// calls queued by runDeferredAt() once they are due, created
+			// with the first one
+			std::unique_ptr<TimerWheel<DelayedItem>> timers;
+			__EVENTEMITTER_MUTEX_DECLARE(mutex);
+			// the handler list of a ThreadedEventEmitter, kept apart from
+			// the queue so that its handlers can defer
+			__EVENTEMITTER_MUTEX_DECLARE(handlersMutex);
+			int readyFd = -1;
+			~State() {
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+				if(readyFd >= 0) {
+					close(readyFd);
+				}
+#endif
+			}
+		};
+		// Mixins sharing this base link one of these to be cleared by
+		// removeAllHandlers(), without allocating.
+		struct RemoveHook {
+			RemoveHook* nextHook = nullptr;
+			void (*clear)(RemoveHook*) = nullptr;
+		};
+	private:
+		std::atomic<State*> deferred;
+		RemoveHook* removeHooks = nullptr;
+	protected:
+		State* peekState() const {
+			return deferred.load(std::memory_order_acquire);
+		}
+		State& state() {
+			State* s = peekState();
+			if(!s) {
+				State* created = new State();
+				if(deferred.compare_exchange_strong(s, created, std::memory_order_acq_rel)) {
+					s = created;
+				}
+				else {
+					delete created;
+				}
+			}
+			return *s;
+		}
+		void addRemoveHook(RemoveHook* hook, void (*clear)(RemoveHook*)) {
+			hook->clear = clear;
+			hook->nextHook = removeHooks;
+			removeHooks = hook;
+		}
+		void runDeferred(DeferredHandler f, Priority priority = Priority::Normal) {
+			State& s = state();
+			__EVENTEMITTER_LOCK_GUARD(s.mutex);
+			bool wasEmpty = !s.pending;
+			s.queue.emplace(priority, std::move(f));
+			s.pending++;
+			if(wasEmpty) {
+				signalReady(s);
+			}
+		}
+		// Queues f once when has come, checked whenever the queue is
+		// drained. Returns a handle for cancelDeferred().
+		TimerHandle runDeferredAt(std::chrono::steady_clock::time_point when, DeferredHandler f, Priority priority = Priority::Normal) {
+			State& s = state();
+			DelayedItem item{std::move(f), priority};
+			TimerHandle handle = 0;
+			{
+				__EVENTEMITTER_LOCK_GUARD(s.mutex);
+				if(!s.timers) {
+					s.timers.reset(new TimerWheel<DelayedItem>());
+				}
+				if(s.timers->schedule(when, item, handle)) {
+					return handle;
+				}
+			}
+			runDeferred(std::move(item.handler), priority);
+			return handle;
+		}
+		// moves the due timers to the queue, called with mutex held
+		void expireTimers(State& s) {
+			bool wasEmpty = !s.pending;
+			s.timers->expire(std::chrono::steady_clock::now(), [&](DelayedItem& item) {
+				s.queue.emplace(item.priority, std::move(item.handler));
+				s.pending++;
+			});
+			if(wasEmpty && s.pending) {
+				signalReady(s);
+			}
+		}
+		// True when a budgeted drain left calls queued. readinessFd() is
+		// signalled again then, the reactor already consumed the edge
+		// that woke it and would not come back for them.
+		bool leftover() {
+			State* s = peekState();
+			if(!s) {
+				return false;
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			if(!s->pending) {
+				return false;
+			}
+			signalReady(*s);
+			return true;
+		}
+		// wake a reactor waiting on readinessFd(), called with mutex held
+		// on the empty -> non-empty transition only
+		void signalReady(State& s) {
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+			if(s.readyFd >= 0) {
+				uint64_t one = 1;
+				while(write(s.readyFd, &one, sizeof(one)) < 0 && errno == EINTR);
+			}
+#endif
+		}
+	public:
+		DeferredBase() : deferred(nullptr) {}
+		// the queue and hooks refer to the source object, a copy starts empty
+		DeferredBase(const DeferredBase&) : deferred(nullptr) {}
+		DeferredBase& operator=(const DeferredBase&) {
+			return *this;
+		}
+		~DeferredBase() {
+			delete peekState();
+		}
+		void removeAllHandlers() {
+			for(RemoveHook* hook = removeHooks;hook;hook = hook->nextHook) {
+				hook->clear(hook);
+			}
+		}
+		void clearDeferred() {
+			State* s = peekState();
+			if(s) {
+				__EVENTEMITTER_LOCK_GUARD(s->mutex);
+				s->queue.clear();
+				for(Resumable* r = s->resumables;r;r = r->nextResumable) {
+					r->queued = false;
+				}
+				s->resumables = nullptr;
+				s->resumablesTail = &s->resumables;
+				s->pending = 0;
+				if(s->timers) {
+					s->timers->clear();
+				}
+			}
+		}
+		// Cancels a call scheduled for later, false if it is already due
+		// (queued or run) or was cancelled before.
+		bool cancelDeferred(TimerHandle handle) {
+			State* s = peekState();
+			if(!s) {
+				return false;
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			return s->timers && s->timers->cancel(handle);
+		}
+		// Queues the calls scheduled for later that are due, signalling
+		// readinessFd() if the queue was empty, and returns when the next
+		// one is, time_point::max() without any. Nothing else watches the
+		// clock: a reactor waiting on readinessFd() uses this as its
+		// timeout and calls it again when the timeout expires.
+		std::chrono::steady_clock::time_point nextDeadline() {
+			State* s = peekState();
+			if(!s) {
+				return std::chrono::steady_clock::time_point::max();
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			if(!s->timers || !s->timers->size()) {
+				return std::chrono::steady_clock::time_point::max();
+			}
+			expireTimers(*s);
+			return s->timers->next();
+		}
+		// calls scheduled for later that are not due yet
+		size_t scheduledDeferred() const {
+			State* s = peekState();
+			if(!s) {
+				return 0;
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			return s->timers ? s->timers->size() : 0;
+		}
+		bool runDeferred() {
+			State* s = peekState();
+			if(!s) {
+				return false;
+			}
+			DeferredHandler handler;
+			Resumable* resumable = nullptr;
+			{
+				__EVENTEMITTER_LOCK_GUARD(s->mutex);
+				if(s->timers && s->timers->size()) {
+					expireTimers(*s);
+				}
+				if(s->resumables) {
+					resumable = s->resumables;
+					s->resumables = resumable->nextResumable;
+					if(!s->resumables) {
+						s->resumablesTail = &s->resumables;
+					}
+					resumable->queued = false;
+					s->pending--;
+				}
+				else if(s->queue.empty()) {
+					return false;
+				}
+				else {
+					// popped first, a handler that throws must not run again
+					handler = std::move(s->queue.front().handler);
+					s->queue.pop_front();
+					s->pending--;
+				}
+			}
+			// run unlocked, so the handler may defer more work
+			if(resumable) {
+				resumable->run(resumable);
+			}
+			else {
+				handler();
+			}
+			return true;
+		}
+		void runAllDeferred() {
+			// TODO: make optimized runAll
+			while(runDeferred());
+		}
+		size_t pendingDeferred() const {
+			State* s = peekState();
+			if(!s) {
+				return 0;
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			return s->pending;
+		}
+		// Runs at most n deferred calls. With DrainMode::Snapshot it also
+		// stops after as many calls as were queued on entry, so calls the
+		// handlers queue meanwhile wait for the next round.
+		DrainResult runDeferredN(size_t n, DrainMode mode = DrainMode::UntilEmpty) {
+			if(mode == DrainMode::Snapshot) {
+				n = std::min(n, pendingDeferred());
+			}
+			size_t count = 0;
+			while(count < n && runDeferred()) {
+				count++;
+			}
+			return DrainResult{count, leftover()};
+		}
+		// Runs deferred calls until budget is spent, looking at the clock
+		// only every checkEvery calls. A single call is never interrupted.
+		DrainResult runDeferredFor(std::chrono::nanoseconds budget, DrainMode mode = DrainMode::UntilEmpty, size_t checkEvery = 16) {
+			checkEvery = std::max<size_t>(checkEvery, 1);
+			auto deadline = std::chrono::steady_clock::now() + budget;
+			size_t n = mode == DrainMode::Snapshot ? pendingDeferred() : static_cast<size_t>(-1);
+			size_t count = 0;
+			while(count < n && runDeferred()) {
+				count++;
+				if(count % checkEvery == 0 && std::chrono::steady_clock::now() >= deadline) {
+					break;
+				}
+			}
+			return DrainResult{count, leftover()};
+		}
+		// queue a callable to be run by whoever drains this object,
+		// lets a DeferredBase act as an executor for other emitters
+		void post(DeferredHandler f, Priority priority = Priority::Normal) {
+			runDeferred(std::move(f), priority);
+		}
+		void post(Resumable& r) {
+			State& s = state();
+			__EVENTEMITTER_LOCK_GUARD(s.mutex);
+			if(r.queued) {
+				return;
+			}
+			bool wasEmpty = !s.pending;
+			r.queued = true;
+			r.nextResumable = nullptr;
+			*s.resumablesTail = &r;
+			s.resumablesTail = &r.nextResumable;
+			s.pending++;
+			if(wasEmpty) {
+				signalReady(s);
+			}
+		}
+		// Takes r back out of the queue, for its owner going away before
+		// it ran. False if it was not queued.
+		bool withdraw(Resumable& r) {
+			State* s = peekState();
+			if(!s) {
+				return false;
+			}
+			__EVENTEMITTER_LOCK_GUARD(s->mutex);
+			if(!r.queued) {
+				return false;
+			}
+			Resumable** link = &s->resumables;
+			while(*link != &r) {
+				link = &(*link)->nextResumable;
+			}
+			*link = r.nextResumable;
+			if(s->resumablesTail == &r.nextResumable) {
+				s->resumablesTail = link;
+			}
+			r.queued = false;
+			s->pending--;
+			return true;
+		}
+		// File descriptor that becomes readable when deferred work is
+		// pending (an eventfd, created on first call). It is signalled only
+		// when the queue goes from empty to non-empty; call drainReady()
+		// once it is readable. Returns -1 where eventfd is not available.
+		int readinessFd() {
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+			State& s = state();
+			__EVENTEMITTER_LOCK_GUARD(s.mutex);
+			if(s.readyFd < 0) {
+				s.readyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if(s.readyFd < 0) {
+					throw std::runtime_error("EventEmitter: eventfd failed");
+				}
+				if(s.pending) {
+					signalReady(s);
+				}
+			}
+			return s.readyFd;
+#else
+			return -1;
+#endif
+		}
+		// Resets readinessFd() and runs deferred work until the queue is
+		// empty. Returns the number of deferred calls run.
+		size_t drainReady() {
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+			State* s = peekState();
+			if(s && s->readyFd >= 0) {
+				uint64_t count;
+				while(read(s->readyFd, &count, sizeof(count)) < 0 && errno == EINTR);
+			}
+#endif
+			size_t count = 0;
+			while(runDeferred()) {
+				count++;
+			}
+			return count;
+		}
+	};
+
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+	// Minimal epoll loop draining any number of deferred queues on the
+	// calling thread, for consumers that have no reactor of their own.
+	// Queues added here are drained only from poll(), which also wakes
+	// for their calls scheduled for later.
+	class DeferredPoller {
+		int epollFd;
+		std::vector<DeferredBase*> queues;
+	public:
+		DeferredPoller() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {
+			if(epollFd < 0) {
+				throw std::runtime_error("EventEmitter: epoll_create1 failed");
+			}
+		}
+		DeferredPoller(const DeferredPoller&) = delete;
+		DeferredPoller& operator=(const DeferredPoller&) = delete;
+		~DeferredPoller() {
+			close(epollFd);
+		}
+		int fd() const {
+			return epollFd;
+		}
+		void add(DeferredBase& queue) {
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.ptr = &queue;
+			if(epoll_ctl(epollFd, EPOLL_CTL_ADD, queue.readinessFd(), &ev) < 0) {
+				throw std::runtime_error("EventEmitter: epoll_ctl failed");
+			}
+			queues.push_back(&queue);
+		}
+		void remove(DeferredBase& queue) {
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, queue.readinessFd(), nullptr);
+			queues.erase(std::remove(queues.begin(), queues.end(), &queue), queues.end());
+		}
+		// Waits up to timeoutMs (-1 blocks), or until the next scheduled
+		// call of a queue is due, and drains every ready queue. Returns the
+		// number of deferred calls run.
+		size_t poll(int timeoutMs = -1) {
+			int wait = timeoutMs;
+			auto now = std::chrono::steady_clock::now();
+			for(DeferredBase* queue : queues) {
+				auto due = queue->nextDeadline();
+				if(due == std::chrono::steady_clock::time_point::max()) {
+					continue;
+				}
+				// rounded up, waking early would only spin
+				auto ms = due <= now ? 0 : std::chrono::duration_cast<std::chrono::milliseconds>(due - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)).count();
+				ms = std::min<decltype(ms)>(ms, INT_MAX);
+				if(wait < 0 || ms < wait) {
+					wait = static_cast<int>(ms);
+				}
+			}
+			epoll_event events[64];
+			int n = epoll_wait(epollFd, events, 64, wait);
+			if(n == 0 && wait != timeoutMs) {
+				// woken for a scheduled call, queue it and pick up the
+				// readiness it signals
+				for(DeferredBase* queue : queues) {
+					queue->nextDeadline();
+				}
+				n = epoll_wait(epollFd, events, 64, 0);
+			}
+			size_t count = 0;
+			for(int i = 0;i < n;++i) {
+				count += static_cast<DeferredBase*>(events[i].data.ptr)->drainReady();
+			}
+			return count;
+		}
+	};
+#endif
+
+#ifdef __EVENTEMITTER_HAS_SHM
+	// Broadcast ring in POSIX shared memory. Any number of processes may
+	// publish; every attached reader sees every event published after it
+	// attached, as long as it keeps up within `capacity` events (older
+	// events are counted in lost()). Slots are guarded seqlock style and
+	// sleeping readers are woken through a futex in the shared header.
+	class SharedRing {
+		static const uint32_t Magic = 0x45455352;
+		struct Header {
+			std::atomic<uint32_t> magic;
+			uint32_t slotSize;
+			uint64_t capacity;
+			alignas(64) std::atomic<uint64_t> writeIndex;
+			alignas(64) std::atomic<uint32_t> sequence; // futex word
+			std::atomic<uint32_t> sleepers;
+		};
+		struct Slot {
+			std::atomic<uint64_t> seq; // 2*index+1 while writing, 2*index+2 when published
+		};
+		int fd = -1;
+		size_t mapSize = 0;
+		Header* header = nullptr;
+		unsigned char* slots = nullptr;
+		size_t stride;
+		size_t payloadSize;
+		uint64_t mask;
+		uint64_t cursor;
+		uint64_t lostEvents = 0;
+
+		Slot* slotAt(uint64_t index) {
+			return reinterpret_cast<Slot*>(slots + (index & mask) * stride);
+		}
+		unsigned char* payloadAt(Slot* slot) {
+			return reinterpret_cast<unsigned char*>(slot) + sizeof(Slot);
+		}
+		static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout) {
+			return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+		}
+		bool available() {
+			uint64_t seq = slotAt(cursor)->seq.load(std::memory_order_acquire);
+			return seq >= 2 * cursor + 2;
+		}
+	public:
+		SharedRing(const std::string& name, size_t payloadSize, size_t capacity) : payloadSize(payloadSize) {
+			size_t slotCount = 1;
+			while(slotCount < capacity) {
+				slotCount <<= 1;
+			}
+			stride = (sizeof(Slot) + payloadSize + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+			mapSize = sizeof(Header) + slotCount * stride;
+
+			bool creator = true;
+			fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			if(fd < 0 && errno == EEXIST) {
+				creator = false;
+				fd = shm_open(name.c_str(), O_RDWR, 0600);
+			}
+			if(fd < 0) {
+				throw std::runtime_error("EventEmitter: shm_open failed");
+			}
+			if(creator) {
+				if(ftruncate(fd, mapSize) < 0) {
+					close(fd);
+					throw std::runtime_error("EventEmitter: ftruncate failed");
+				}
+			}
+			else {
+				// wait for the creator to size and initialise the segment
+				struct stat st;
+				while(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) < sizeof(Header)) {
+					std::this_thread::yield();
+				}
+			}
+			void* mem = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(mem == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("EventEmitter: mmap failed");
+			}
+			header = static_cast<Header*>(mem);
+			if(creator) {
+				header->slotSize = static_cast<uint32_t>(payloadSize);
+				header->capacity = slotCount;
+				header->writeIndex.store(0);
+				header->sequence.store(0);
+				header->sleepers.store(0);
+				header->magic.store(Magic, std::memory_order_release);
+			}
+			else {
+				while(header->magic.load(std::memory_order_acquire) != Magic) {
+					std::this_thread::yield();
+				}
+				if(header->slotSize != payloadSize) {
+					munmap(header, sizeof(Header));
+					close(fd);
+					throw std::runtime_error("EventEmitter: shared ring has a different event layout");
+				}
+				slotCount = header->capacity;
+				mapSize = sizeof(Header) + slotCount * stride;
+			}
+			munmap(header, sizeof(Header));
+			mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(mem == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("EventEmitter: mmap failed");
+			}
+			header = static_cast<Header*>(mem);
+			slots = static_cast<unsigned char*>(mem) + sizeof(Header);
+			mask = slotCount - 1;
+			cursor = header->writeIndex.load(std::memory_order_acquire);
+		}
+		SharedRing(const SharedRing&) = delete;
+		SharedRing& operator=(const SharedRing&) = delete;
+		~SharedRing() {
+			munmap(header, mapSize);
+			close(fd);
+		}
+		static void unlink(const std::string& name) {
+			shm_unlink(name.c_str());
+		}
+		void publish(const void* payload) {
+			uint64_t index = header->writeIndex.fetch_add(1, std::memory_order_acq_rel);
+			Slot* slot = slotAt(index);
+			slot->seq.store(2 * index + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			memcpy(payloadAt(slot), payload, payloadSize);
+			slot->seq.store(2 * index + 2, std::memory_order_release);
+			header->sequence.fetch_add(1, std::memory_order_seq_cst);
+			if(header->sleepers.load(std::memory_order_seq_cst)) {
+				futex(&header->sequence, FUTEX_WAKE, INT_MAX, nullptr);
+			}
+		}
+		// Copies the next event into out, returns false if there is none.
+		bool consume(void* out) {
+			for(;;) {
+				Slot* slot = slotAt(cursor);
+				uint64_t seq = slot->seq.load(std::memory_order_acquire);
+				if(seq < 2 * cursor + 2) {
+					return false;
+				}
+				if(seq == 2 * cursor + 2) {
+					memcpy(out, payloadAt(slot), payloadSize);
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if(slot->seq.load(std::memory_order_relaxed) == seq) {
+						cursor++;
+						return true;
+					}
+				}
+				// overwritten by a writer that lapped us, skip to the oldest slot
+				uint64_t written = header->writeIndex.load(std::memory_order_acquire);
+				uint64_t oldest = written > mask + 1 ? written - (mask + 1) : 0;
+				if(oldest > cursor) {
+					lostEvents += oldest - cursor;
+					cursor = oldest;
+				}
+				else {
+					lostEvents++;
+					cursor++;
+				}
+			}
+		}
+		// Waits until an event can be consumed, spinning briefly before
+		// sleeping on the futex. Returns false on timeout.
+		bool wait(std::chrono::nanoseconds timeout) {
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			for(int spin = 0;spin < 2000;++spin) {
+				if(available()) {
+					return true;
+				}
+			}
+			for(;;) {
+				uint32_t sequence = header->sequence.load(std::memory_order_seq_cst);
+				header->sleepers.fetch_add(1, std::memory_order_seq_cst);
+				bool ready = available();
+				if(!ready) {
+					auto left = deadline - std::chrono::steady_clock::now();
+					if(left <= std::chrono::nanoseconds::zero()) {
+						header->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+						return false;
+					}
+					auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+					timespec ts = { static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000) };
+					futex(&header->sequence, FUTEX_WAIT, sequence, &ts);
+					ready = available();
+				}
+				header->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+				if(ready) {
+					return true;
+				}
+			}
+		}
+		uint64_t lost() const {
+			return lostEvents;
+		}
+	};
+
+#endif // __EVENTEMITTER_HAS_SHM
+
+	// Trivially copyable storage for an argument pack, std::tuple is not.
+	template<typename... Rest> struct PackedArgs {};
+	template<typename T, typename... Rest> struct PackedArgs<T, Rest...> {
+		T head;
+		PackedArgs<Rest...> tail;
+	};
+	template<size_t I> struct PackedGet {
+		template<typename P> static auto& get(P& packed) {
+			return PackedGet<I - 1>::get(packed.tail);
+		}
+	};
+	template<> struct PackedGet<0> {
+		template<typename P> static auto& get(P& packed) {
+			return packed.head;
+		}
+	};
+	inline void packArgs(PackedArgs<>&) {}
+	template<typename T, typename... Rest, typename Arg, typename... Args>
+	void packArgs(PackedArgs<T, Rest...>& packed, Arg&& arg, Args&&... fargs) {
+		packed.head = std::forward<Arg>(arg);
+		packArgs(packed.tail, std::forward<Args>(fargs)...);
+	}
+	template<typename... Rest> struct AllTriviallyCopyable : std::true_type {};
+	template<typename T, typename... Rest> struct AllTriviallyCopyable<T, Rest...>
+		: std::integral_constant<bool, std::is_trivially_copyable<typename std::decay<T>::type>::value && AllTriviallyCopyable<Rest...>::value> {};
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	typedef std::mutex WaiterLock;
+#else
+	struct WaiterLock {
+		void lock() {}
+		void unlock() {}
+	};
+#endif
+	struct WaiterGuard {
+		WaiterLock& lock;
+		WaiterGuard(WaiterLock& lock) : lock(lock) { lock.lock(); }
+		~WaiterGuard() { lock.unlock(); }
+	};
 
-#define __EVENTEMITTER_MUTEX_DECLARE(mutex) std::mutex mutex;
-#define __EVENTEMITTER_LOCK_GUARD(mutex) std::lock_guard<std::mutex> guard(mutex);
+	// Lock policies of LockedEventEmitterCore. Each offers an exclusive and
+	// a shared side; shared says whether they differ, only then trigger()
+	// tries the shared side first.
+	struct NullLock {
+		static constexpr bool shared = false;
+		void lock() {}
+		void unlock() {}
+		void lock_shared() {}
+		void unlock_shared() {}
+	};
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	struct MutexLock : std::mutex {
+		static constexpr bool shared = false;
+		void lock_shared() {
+			lock();
+		}
+		void unlock_shared() {
+			unlock();
+		}
+	};
+	// for critical sections of a few instructions; spins on a plain load
+	// so that waiting cores do not keep stealing the cache line
+	class SpinLock {
+		std::atomic<bool> locked;
+	public:
+		static constexpr bool shared = false;
+		SpinLock() : locked(false) {}
+		void lock() {
+			while(locked.exchange(true, std::memory_order_acquire)) {
+				for(int spin = 0;locked.load(std::memory_order_relaxed);++spin) {
+					if(spin > 64) {
+						std::this_thread::yield();
+					}
+				}
+			}
+		}
+		void unlock() {
+			locked.store(false, std::memory_order_release);
+		}
+		void lock_shared() {
+			lock();
+		}
+		void unlock_shared() {
+			unlock();
+		}
+	};
+#if __cplusplus >= 201703L
+	struct SharedLock : std::shared_mutex {
+#else
+	struct SharedLock : std::shared_timed_mutex {
+#endif
+		static constexpr bool shared = true;
+	};
 #else
-#define __EVENTEMITTER_MUTEX_DECLARE(mutex);
-#define __EVENTEMITTER_LOCK_GUARD(mutex);
+	typedef NullLock MutexLock;
+	typedef NullLock SpinLock;
+	typedef NullLock SharedLock;
 #endif
+	template<typename L> struct ExclusiveGuard {
+		L& lock;
+		ExclusiveGuard(L& lock) : lock(lock) { lock.lock(); }
+		~ExclusiveGuard() { lock.unlock(); }
+	};
+	template<typename L> struct SharedGuard {
+		L& lock;
+		SharedGuard(L& lock) : lock(lock) { lock.lock_shared(); }
+		~SharedGuard() { lock.unlock_shared(); }
+	};
+	// Any of the above, or WaiterLock, without its type: awaiters and
+	// streams only need to lock the list they were registered on.
+	struct LockRef {
+		void* target;
+		void (*acquire)(void*);
+		void (*release)(void*);
+		LockRef(std::nullptr_t = nullptr) : target(nullptr), acquire(nullptr), release(nullptr) {}
+		template<typename L> LockRef(L* lockable) : target(lockable), acquire([](void* l) {
+			static_cast<L*>(l)->lock();
+		}), release([](void* l) {
+			static_cast<L*>(l)->unlock();
+		}) {}
+		explicit operator bool() const {
+			return target != nullptr;
+		}
+		void lock() {
+			acquire(target);
+		}
+		void unlock() {
+			release(target);
+		}
+	};
+
+	// The last Depth argument packs of an event, overwritten in place so
+	// that recording does not allocate once every slot was written. Packs
+	// are copied in and out under a spinlock held only for the copy.
+	template<size_t Depth, bool Trivial, typename... Rest>
+	class StickyRing {
+	public:
+		typedef std::tuple<typename std::decay<Rest>::type...> Args;
+	private:
+		Args ring[Depth];
+		std::atomic<size_t> written;
+		SpinLock m;
+	public:
+		StickyRing() : written(0) {}
+		template<typename... Args> void record(Args&&... fargs) {
+			ExclusiveGuard<SpinLock> guard(m);
+			size_t total = written.load(std::memory_order_relaxed);
+			ring[total % Depth] = std::forward_as_tuple(fargs...);
+			written.store(total + 1, std::memory_order_relaxed);
+		}
+		size_t snapshot(Args* out) {
+			ExclusiveGuard<SpinLock> guard(m);
+			size_t total = written.load(std::memory_order_relaxed);
+			size_t count = total < Depth ? total : Depth;
+			for(size_t i = 0;i < count;++i) {
+				out[i] = ring[(total - count + i) % Depth];
+			}
+			return count;
+		}
+		bool empty() const {
+			return written.load(std::memory_order_relaxed) == 0;
+		}
+	};
+	// Trivially copyable packs are kept as atomic words and read seqlock
+	// style, so a trigger never waits for readers: a reader overlapping a
+	// trigger sees the sequence change and retries.
+	template<size_t Depth, typename... Rest>
+	class StickyRing<Depth, true, Rest...> {
+	public:
+		typedef std::tuple<typename std::decay<Rest>::type...> Args;
+	private:
+		typedef PackedArgs<typename std::decay<Rest>::type...> Packed;
+		static_assert(std::is_trivially_copyable<Packed>::value, "the seqlock history needs trivially copyable arguments");
+		static const size_t Words = (sizeof(Packed) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+		std::atomic<uintptr_t> ring[Depth][Words];
+		std::atomic<size_t> written;
+		std::atomic<unsigned> sequence;
+		SpinLock m;
+
+		template<size_t... I> static Args unpack(Packed& packed, std::index_sequence<I...>) {
+			return Args(PackedGet<I>::get(packed)...);
+		}
+	public:
+		StickyRing() : written(0), sequence(0) {}
+		template<typename... Args> void record(Args&&... fargs) {
+			Packed packed{};
+			packArgs(packed, std::forward<Args>(fargs)...);
+			uintptr_t words[Words] = {};
+			std::memcpy(words, &packed, sizeof(Packed));
+			ExclusiveGuard<SpinLock> guard(m);
+			unsigned s = sequence.load(std::memory_order_relaxed);
+			sequence.store(s + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			size_t total = written.load(std::memory_order_relaxed);
+			for(size_t w = 0;w < Words;++w) {
+				ring[total % Depth][w].store(words[w], std::memory_order_relaxed);
+			}
+			written.store(total + 1, std::memory_order_relaxed);
+			sequence.store(s + 2, std::memory_order_release);
+		}
+		size_t snapshot(Args* out) {
+			uintptr_t words[Depth][Words];
+			size_t count;
+			while(true) {
+				unsigned s = sequence.load(std::memory_order_acquire);
+				if(s & 1) {
+					continue;
+				}
+				size_t total = written.load(std::memory_order_relaxed);
+				count = total < Depth ? total : Depth;
+				for(size_t i = 0;i < count;++i) {
+					for(size_t w = 0;w < Words;++w) {
+						words[i][w] = ring[(total - count + i) % Depth][w].load(std::memory_order_relaxed);
+					}
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if(sequence.load(std::memory_order_relaxed) == s) {
+					break;
+				}
+			}
+			for(size_t i = 0;i < count;++i) {
+				Packed packed;
+				std::memcpy(&packed, words[i], sizeof(Packed));
+				out[i] = unpack(packed, std::index_sequence_for<Rest...>());
+			}
+			return count;
+		}
+		bool empty() const {
+			return written.load(std::memory_order_relaxed) == 0;
+		}
+	};
+	template<size_t Depth, typename... Rest>
+	class StickyHistory : public StickyRing<Depth, AllTriviallyCopyable<Rest...>::value, Rest...> {
+		static_assert(Depth > 0, "a sticky history keeps at least one event");
+	public:
+		StickyHistory() {}
+		StickyHistory(const StickyHistory&) = delete;
+		StickyHistory& operator=(const StickyHistory&) = delete;
+	};
+	template<typename F, typename Tuple, size_t... I>
+	inline void applyTuple(F&& f, Tuple& args, std::index_sequence<I...>) {
+		f(std::get<I>(args)...);
+	}
+	// Hands what the factory of a lazy emit made to f: a tuple is spread
+	// over the arguments, unless the event takes just one.
+	template<typename Handler> struct LazyArgs;
+	template<typename R, typename... Rest>
+	struct LazyArgs<std::function<R(Rest...)>> {
+		template<typename F, typename Value> static void spread(F& f, Value&& value, std::true_type) {
+			f(std::forward<Value>(value));
+		}
+		template<typename F, typename Tuple> static void spread(F& f, Tuple&& args, std::false_type) {
+			applyTuple(f, args, std::index_sequence_for<Rest...>());
+		}
+		template<typename F, typename Factory> static void apply(F&& f, Factory& factory) {
+			spread(f, factory(), std::integral_constant<bool, sizeof...(Rest) == 1>());
+		}
+	};
+
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+	// Turns fd readiness, timerfd expirations and signals into handler
+	// calls from one epoll loop. poll() harvests up to maxEvents ready fds
+	// per epoll_wait; start() runs it on a thread of its own. Handlers run
+	// on the loop thread, or are posted to the queue given when the source
+	// was added. Posted sources are coalesced: an fd is not reported again
+	// and timer expirations add up until the posted call ran. Sources are
+	// identified by the handle the add call returns, never reused, so an fd
+	// number the OS hands out again cannot be mistaken for an old source.
+	class EventSource {
+	public:
+		typedef uint64_t Handle;
+		typedef std::function<void(int fd, uint32_t events)> FdHandler;
+		typedef std::function<void(uint64_t expirations)> TimerHandler;
+		typedef std::function<void(int signal)> SignalHandler;
+	private:
+		enum class Kind : uint8_t {
+			Fd,
+			Timer,
+			Signal
+		};
+		struct Source {
+			Kind kind;
+			int fd;
+			Handle handle;
+			uint32_t events;
+			DeferredBase* queue;
+			FdHandler onFd;
+			TimerHandler onTimer;
+			SignalHandler onSignal;
+			std::atomic<uint64_t> pending;
+			std::atomic<bool> removed;
+			Source(Kind kind, int fd, uint32_t events, DeferredBase* queue) : kind(kind), fd(fd), handle(0), events(events), queue(queue), pending(0), removed(false) {}
+		};
+		int epollFd;
+		int wakeFd;
+		std::vector<epoll_event> ready;
+		// signals read by the current poll(), reused across calls
+		std::vector<int> signals;
+		WaiterLock m;
+		std::unordered_map<Handle, std::shared_ptr<Source>> sources;
+		// the source whose epoll registration an fd number is; a closed
+		// and reused fd is registered anew and must not be deleted for the
+		// stale source
+		std::unordered_map<int, Handle> registered;
+		// 0 is the wake eventfd
+		Handle nextHandle = 1;
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		std::thread thread;
+		std::atomic<bool> running;
+#endif
+
+		static void check(int result, const char* what) {
+			if(result < 0) {
+				throw std::runtime_error(std::string("EventEmitter: ") + what + " failed");
+			}
+		}
+		// one-shot while queued, rearmed once the posted call ran
+		uint32_t epollEvents(const Source& source) {
+			return source.events | (source.kind == Kind::Fd && source.queue ? static_cast<uint32_t>(EPOLLONESHOT) : 0u);
+		}
+		Handle add(std::shared_ptr<Source> source) {
+			WaiterGuard guard(m);
+			source->handle = nextHandle++;
+			epoll_event ev;
+			ev.events = epollEvents(*source);
+			ev.data.u64 = source->handle;
+			if(epoll_ctl(epollFd, EPOLL_CTL_ADD, source->fd, &ev) < 0) {
+				if(source->kind != Kind::Fd) {
+					close(source->fd);
+				}
+				check(-1, "epoll_ctl");
+			}
+			registered[source->fd] = source->handle;
+			Handle handle = source->handle;
+			sources[handle] = std::move(source);
+			return handle;
+		}
+		void rearm(Source& source) {
+			WaiterGuard guard(m);
+			if(!source.removed.load()) {
+				epoll_event ev;
+				ev.events = epollEvents(source);
+				ev.data.u64 = source.handle;
+				epoll_ctl(epollFd, EPOLL_CTL_MOD, source.fd, &ev);
+			}
+		}
+		// reads what a timer or signal source has to say, under m so that
+		// remove() cannot close the fd meanwhile
+		void harvest(Source& source, uint64_t& expirations) {
+			if(source.kind == Kind::Timer) {
+				uint64_t count;
+				if(read(source.fd, &count, sizeof(count)) == sizeof(count)) {
+					expirations = count;
+				}
+			}
+			else if(source.kind == Kind::Signal) {
+				signalfd_siginfo info;
+				while(read(source.fd, &info, sizeof(info)) == sizeof(info)) {
+					signals.push_back(static_cast<int>(info.ssi_signo));
+				}
+			}
+		}
+		size_t fire(const std::shared_ptr<Source>& source, uint32_t events, uint64_t expirations) {
+			Source& s = *source;
+			switch(s.kind) {
+			case Kind::Fd:
+				if(!s.queue) {
+					s.onFd(s.fd, events);
+				}
+				else {
+					std::shared_ptr<Source> keep = source;
+					s.queue->post([this, keep, events] {
+						keep->onFd(keep->fd, events);
+						rearm(*keep);
+					});
+				}
+				return 1;
+			case Kind::Timer:
+				if(!expirations) {
+					return 0;
+				}
+				if(!s.queue) {
+					s.onTimer(expirations);
+				}
+				else if(s.pending.fetch_add(expirations) == 0) {
+					std::shared_ptr<Source> keep = source;
+					s.queue->post([keep] {
+						keep->onTimer(keep->pending.exchange(0));
+					});
+				}
+				return 1;
+			case Kind::Signal:
+				for(int signal : signals) {
+					if(!s.queue) {
+						s.onSignal(signal);
+					}
+					else {
+						std::shared_ptr<Source> keep = source;
+						s.queue->post([keep, signal] {
+							keep->onSignal(signal);
+						});
+					}
+				}
+				return signals.size();
+			}
+			return 0;
+		}
+	public:
+		explicit EventSource(size_t maxEvents = 256) : epollFd(epoll_create1(EPOLL_CLOEXEC)), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), ready(maxEvents) {
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			running = false;
+#endif
+			check(epollFd, "epoll_create1");
+			check(wakeFd, "eventfd");
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.u64 = 0;
+			check(epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev), "epoll_ctl");
+		}
+		EventSource(const EventSource&) = delete;
+		EventSource& operator=(const EventSource&) = delete;
+		~EventSource() {
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			stop();
+#endif
+			for(auto& it : sources) {
+				it.second->removed = true;
+				if(it.second->kind != Kind::Fd) {
+					close(it.second->fd);
+				}
+			}
+			close(wakeFd);
+			close(epollFd);
+		}
+		// fd stays owned by the caller; events as for epoll (EPOLLIN, ...)
+		Handle watch(int fd, uint32_t events, FdHandler handler, DeferredBase* queue = nullptr) {
+			auto source = std::make_shared<Source>(Kind::Fd, fd, events, queue);
+			source->onFd = std::move(handler);
+			return add(std::move(source));
+		}
+		// The timerfd is closed by remove(). The first expiration is after
+		// interval, then every interval unless repeat is false.
+		Handle addTimer(std::chrono::nanoseconds interval, TimerHandler handler, DeferredBase* queue = nullptr, bool repeat = true) {
+			int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+			check(fd, "timerfd_create");
+			itimerspec spec = {};
+			spec.it_value.tv_sec = static_cast<time_t>(interval.count() / 1000000000);
+			spec.it_value.tv_nsec = static_cast<long>(interval.count() % 1000000000);
+			if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+				spec.it_value.tv_nsec = 1;
+			}
+			if(repeat) {
+				spec.it_interval = spec.it_value;
+			}
+			if(timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+				close(fd);
+				check(-1, "timerfd_settime");
+			}
+			auto source = std::make_shared<Source>(Kind::Timer, fd, EPOLLIN, queue);
+			source->onTimer = std::move(handler);
+			return add(std::move(source));
+		}
+		// Blocks signals in the calling thread and reads them through a
+		// signalfd, closed by remove(). Block them in every
+		// other thread too (create those afterwards, they inherit the
+		// mask), or the signals may be delivered there instead.
+		Handle addSignals(std::initializer_list<int> signals, SignalHandler handler, DeferredBase* queue = nullptr) {
+			sigset_t mask;
+			sigemptyset(&mask);
+			for(int signal : signals) {
+				sigaddset(&mask, signal);
+			}
+			check(pthread_sigmask(SIG_BLOCK, &mask, nullptr) == 0 ? 0 : -1, "pthread_sigmask");
+			int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+			check(fd, "signalfd");
+			auto source = std::make_shared<Source>(Kind::Signal, fd, EPOLLIN, queue);
+			source->onSignal = std::move(handler);
+			return add(std::move(source));
+		}
+		bool remove(Handle handle) {
+			WaiterGuard guard(m);
+			auto it = sources.find(handle);
+			if(it == sources.end()) {
+				return false;
+			}
+			Source& source = *it->second;
+			source.removed = true;
+			auto reg = registered.find(source.fd);
+			if(reg != registered.end() && reg->second == handle) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, source.fd, nullptr);
+				registered.erase(reg);
+			}
+			if(source.kind != Kind::Fd) {
+				close(source.fd);
+			}
+			sources.erase(it);
+			return true;
+		}
+		// Waits up to timeoutMs (-1 blocks) for one batch of ready sources.
+		// Returns the number of handler calls run or posted.
+		size_t poll(int timeoutMs = -1) {
+			int n = epoll_wait(epollFd, ready.data(), static_cast<int>(ready.size()), timeoutMs);
+			size_t count = 0;
+			for(int i = 0;i < n;++i) {
+				Handle handle = ready[i].data.u64;
+				if(!handle) {
+					uint64_t value;
+					while(read(wakeFd, &value, sizeof(value)) < 0 && errno == EINTR);
+					continue;
+				}
+				std::shared_ptr<Source> source;
+				uint64_t expirations = 0;
+				signals.clear();
+				{
+					WaiterGuard guard(m);
+					auto it = sources.find(handle);
+					if(it == sources.end()) {
+						continue;
+					}
+					source = it->second;
+					harvest(*source, expirations);
+				}
+				count += fire(source, ready[i].events, expirations);
+			}
+			return count;
+		}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		void start() {
+			if(running.exchange(true)) {
+				return;
+			}
+			thread = std::thread([this] {
+				while(running.load()) {
+					poll();
+				}
+			});
+		}
+		void stop() {
+			if(!running.exchange(false)) {
+				return;
+			}
+			uint64_t one = 1;
+			while(write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR);
+			thread.join();
+		}
+#endif
+	};
+#endif // __EVENTEMITTER_HAS_EVENTFD
+
+#ifdef __EVENTEMITTER_HAS_EVENTLOG
+	// Byte sinks and sources handed to Serializer specialisations.
+	class RecordWriter {
+		unsigned char* data;
+		size_t pos;
+		size_t capacity;
+	public:
+		RecordWriter(unsigned char* data, size_t pos, size_t capacity) : data(data), pos(pos), capacity(capacity) {}
+		void put(const void* bytes, size_t size) {
+			if(pos + size > capacity) {
+				pos = capacity + 1;
+				return;
+			}
+			memcpy(data + pos, bytes, size);
+			pos += size;
+		}
+		bool overflow() const {
+			return pos > capacity;
+		}
+		size_t position() const {
+			return pos;
+		}
+	};
+	class RecordReader {
+		const unsigned char* data;
+		size_t pos;
+		size_t end;
+	public:
+		RecordReader(const unsigned char* data, size_t pos, size_t end) : data(data), pos(pos), end(end) {}
+		void get(void* bytes, size_t size) {
+			if(pos + size > end) {
+				throw std::runtime_error("EventEmitter: truncated event record");
+			}
+			memcpy(bytes, data + pos, size);
+			pos += size;
+		}
+	};
+
+	// Per-type encoding of recorded arguments. Trivially copyable types and
+	// std::string are built in; specialise for anything else.
+	template<typename T, typename Enable = void> struct Serializer;
+	template<typename T> struct Serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+		static void write(RecordWriter& writer, const T& value) {
+			writer.put(&value, sizeof(T));
+		}
+		static T read(RecordReader& reader) {
+			T value;
+			reader.get(&value, sizeof(T));
+			return value;
+		}
+	};
+	template<> struct Serializer<std::string> {
+		static void write(RecordWriter& writer, const std::string& value) {
+			uint32_t size = static_cast<uint32_t>(value.size());
+			writer.put(&size, sizeof(size));
+			writer.put(value.data(), size);
+		}
+		static std::string read(RecordReader& reader) {
+			uint32_t size;
+			reader.get(&size, sizeof(size));
+			std::string value(size, '\0');
+			reader.get(&value[0], size);
+			return value;
+		}
+	};
+
+	// Append-only, memory-mapped log of triggered events. Each thread
+	// serialises into its own batch buffer, found through a per-thread
+	// cache with an entry per log; a full batch is reserved in the file
+	// with a single fetch_add and copied in, so recording neither locks
+	// nor allocates per event. Threads other than the one destroying the
+	// log should flush() before it goes away.
+	class EventLog {
+	public:
+		static const size_t BatchSize = 64 * 1024;
+		struct FileHeader {
+			uint64_t magic;
+			uint64_t capacity;
+			std::atomic<uint64_t> used;
+		};
+		struct RecordHeader {
+			uint32_t size; // including this header
+			uint32_t emitterId;
+			uint64_t timestamp; // steady_clock nanoseconds
+		};
+		static const uint64_t Magic = 0x474f4c5445454545ULL;
+	private:
+		struct Batch {
+			std::thread::id owner;
+			size_t size = 0;
+			unsigned char data[BatchSize];
+		};
+		struct LocalCache {
+			uint64_t logId;
+			Batch* batch;
+		};
+		// Every live log owns a slot in each thread's cache, so a thread
+		// writing to several logs keeps one entry per log. Slots of
+		// destroyed logs are handed out again; the log id tells a stale
+		// entry from a current one.
+		struct CacheSlots {
+			WaiterLock m;
+			std::vector<size_t> free;
+			size_t count = 0;
+		};
+		static std::atomic<uint64_t>& idCounter() {
+			static std::atomic<uint64_t> counter(0);
+			return counter;
+		}
+		static CacheSlots& cacheSlots() {
+			static CacheSlots slots;
+			return slots;
+		}
+
+		uint64_t id;
+		size_t slot;
+		int fd;
+		size_t mapSize;
+		FileHeader* header;
+		unsigned char* records;
+		std::atomic<uint64_t> droppedEvents;
+		WaiterLock registryLock;
+		std::vector<std::unique_ptr<Batch>> batches;
+
+		Batch& localBatch() {
+			thread_local std::vector<LocalCache> cache;
+			if(slot < cache.size() && cache[slot].logId == id) {
+				return *cache[slot].batch;
+			}
+			std::thread::id self = std::this_thread::get_id();
+			WaiterGuard guard(registryLock);
+			Batch* batch = nullptr;
+			for(auto& b : batches) {
+				if(b->owner == self) {
+					batch = b.get();
+				}
+			}
+			if(!batch) {
+				batches.emplace_back(new Batch());
+				batch = batches.back().get();
+				batch->owner = self;
+			}
+			if(cache.size() <= slot) {
+				cache.resize(slot + 1, LocalCache{0, nullptr});
+			}
+			cache[slot] = LocalCache{id, batch};
+			return *batch;
+		}
+		void flushBatch(Batch& batch) {
+			if(!batch.size) {
+				return;
+			}
+			uint64_t offset = header->used.fetch_add(batch.size, std::memory_order_acq_rel);
+			if(offset + batch.size <= header->capacity) {
+				memcpy(records + offset, batch.data, batch.size);
+			}
+			else {
+				droppedEvents++;
+			}
+			batch.size = 0;
+		}
+	public:
+		EventLog(const std::string& path, size_t capacity = size_t(1) << 30) : id(++idCounter()), droppedEvents(0) {
+			fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if(fd < 0) {
+				throw std::runtime_error("EventEmitter: cannot create event log");
+			}
+			mapSize = sizeof(FileHeader) + capacity;
+			// the file is sparse, pages are only backed once written
+			if(ftruncate(fd, mapSize) < 0) {
+				close(fd);
+				throw std::runtime_error("EventEmitter: cannot size event log");
+			}
+			void* mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(mem == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("EventEmitter: cannot map event log");
+			}
+			header = static_cast<FileHeader*>(mem);
+			header->magic = Magic;
+			header->capacity = capacity;
+			header->used.store(0);
+			records = static_cast<unsigned char*>(mem) + sizeof(FileHeader);
+			CacheSlots& slots = cacheSlots();
+			WaiterGuard guard(slots.m);
+			if(slots.free.empty()) {
+				slot = slots.count++;
+			}
+			else {
+				slot = slots.free.back();
+				slots.free.pop_back();
+			}
+		}
+		EventLog(const EventLog&) = delete;
+		EventLog& operator=(const EventLog&) = delete;
+		~EventLog() {
+			{
+				WaiterGuard guard(registryLock);
+				for(auto& batch : batches) {
+					flushBatch(*batch);
+				}
+			}
+			uint64_t used = std::min<uint64_t>(header->used.load(), header->capacity);
+			header->used.store(used);
+			msync(header, mapSize, MS_SYNC);
+			munmap(header, mapSize);
+			if(ftruncate(fd, sizeof(FileHeader) + used) < 0) {
+				// keeping the sparse tail is harmless
+			}
+			close(fd);
+			CacheSlots& slots = cacheSlots();
+			WaiterGuard guard(slots.m);
+			slots.free.push_back(slot);
+		}
+		template<typename... Args> void record(uint32_t emitterId, const Args&... fargs) {
+			Batch& batch = localBatch();
+			for(int attempt = 0;attempt < 2;++attempt) {
+				RecordWriter writer(batch.data, batch.size + sizeof(RecordHeader), BatchSize);
+				int expand[] = { 0, (Serializer<typename std::decay<Args>::type>::write(writer, fargs), 0)... };
+				(void)expand;
+				if(!writer.overflow()) {
+					RecordHeader record;
+					record.size = static_cast<uint32_t>(writer.position() - batch.size);
+					record.emitterId = emitterId;
+					record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+					memcpy(batch.data + batch.size, &record, sizeof(record));
+					batch.size = writer.position();
+					return;
+				}
+				if(!batch.size) {
+					break;
+				}
+				flushBatch(batch);
+			}
+			droppedEvents++;
+		}
+		// Publishes the calling thread's batch to the file.
+		void flush() {
+			flushBatch(localBatch());
+		}
+		// Number of records or batches that did not fit.
+		uint64_t dropped() const {
+			return droppedEvents.load();
+		}
+		// Handler that records every event of an emitter under emitterId:
+		// emitter.onFoo(log.recorder<Args...>(id))
+		template<typename... Rest> std::function<void(Rest...)> recorder(uint32_t emitterId) {
+			EventLog* log = this;
+			return [log, emitterId](Rest... fargs) {
+				log->record(emitterId, fargs...);
+			};
+		}
+	};
+
+	// Re-triggers the events of an EventLog, in timestamp order, at the
+	// original pace scaled by `speed` (0 replays as fast as possible).
+	class EventReplayer {
+		typedef std::function<void(RecordReader&)> Route;
+		int fd;
+		size_t mapSize;
+		const unsigned char* records;
+		uint64_t used;
+		std::map<uint32_t, Route> routes;
+
+		template<typename F, typename Tuple, size_t... I>
+		static void apply(F& target, Tuple& args, std::index_sequence<I...>) {
+			target(std::move(std::get<I>(args))...);
+		}
+	public:
+		EventReplayer(const std::string& path) {
+			fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat st;
+			if(fd < 0 || fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(EventLog::FileHeader)) {
+				if(fd >= 0) {
+					close(fd);
+				}
+				throw std::runtime_error("EventEmitter: cannot open event log");
+			}
+			mapSize = st.st_size;
+			void* mem = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+			if(mem == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("EventEmitter: cannot map event log");
+			}
+			const EventLog::FileHeader* header = static_cast<const EventLog::FileHeader*>(mem);
+			if(header->magic != EventLog::Magic) {
+				munmap(mem, mapSize);
+				close(fd);
+				throw std::runtime_error("EventEmitter: not an event log");
+			}
+			records = static_cast<const unsigned char*>(mem) + sizeof(EventLog::FileHeader);
+			used = std::min<uint64_t>(header->used.load(), mapSize - sizeof(EventLog::FileHeader));
+		}
+		EventReplayer(const EventReplayer&) = delete;
+		EventReplayer& operator=(const EventReplayer&) = delete;
+		~EventReplayer() {
+			munmap(const_cast<unsigned char*>(records) - sizeof(EventLog::FileHeader), mapSize);
+			close(fd);
+		}
+		// Sends events recorded under emitterId to target, typically a
+		// lambda re-triggering the emitter under test.
+		template<typename... Rest, typename F> void route(uint32_t emitterId, F target) {
+			routes[emitterId] = [target](RecordReader& reader) mutable {
+				std::tuple<typename std::decay<Rest>::type...> args { Serializer<typename std::decay<Rest>::type>::read(reader)... };
+				apply(target, args, std::index_sequence_for<Rest...>());
+			};
+		}
+		size_t replay(double speed = 1.0) {
+			std::vector<std::pair<uint64_t, uint64_t>> order; // timestamp, offset
+			for(uint64_t offset = 0;offset + sizeof(EventLog::RecordHeader) <= used;) {
+				EventLog::RecordHeader record;
+				memcpy(&record, records + offset, sizeof(record));
+				if(record.size < sizeof(record) || offset + record.size > used) {
+					break; // reserved but never written
+				}
+				order.emplace_back(record.timestamp, offset);
+				offset += record.size;
+			}
+			std::stable_sort(order.begin(), order.end(), [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
+				return a.first < b.first;
+			});
+			size_t count = 0;
+			auto start = std::chrono::steady_clock::now();
+			for(auto& entry : order) {
+				EventLog::RecordHeader record;
+				memcpy(&record, records + entry.second, sizeof(record));
+				auto route = routes.find(record.emitterId);
+				if(route == routes.end()) {
+					continue;
+				}
+				if(speed > 0) {
+					std::chrono::nanoseconds offset(static_cast<int64_t>((entry.first - order.front().first) / speed));
+					std::this_thread::sleep_until(start + offset);
+				}
+				RecordReader reader(records, entry.second + sizeof(record), entry.second + record.size);
+				route->second(reader);
+				count++;
+			}
+			return count;
+		}
+	};
+#endif // __EVENTEMITTER_HAS_EVENTLOG
+
+	// Intrusive, doubly linked list of waiters (coroutine awaiters and
+	// event streams). Nodes live inside the coroutine frame, so waiting
+	// does not allocate; a trigger without waiters pays a single branch.
+	struct WaiterNode {
+		WaiterNode* next = nullptr;
+		WaiterNode** prev = nullptr; // null when not linked
+		WaiterNode* ready = nullptr; // chain of nodes to resume after trigger
+		bool persistent = false;
+		// stores the event, returns true if the node needs resuming
+		bool (*deliver)(WaiterNode*, const void* args) = nullptr;
+		void (*resume)(WaiterNode*) = nullptr;
+	};
+
+	class WaiterList {
+		struct Cursor {
+			WaiterNode* node;
+			Cursor* outer;
+		};
+		WaiterNode* head = nullptr;
+		Cursor* cursors = nullptr;
+		// linked nodes, readable without the emitter lock
+		std::atomic<unsigned> linked{0};
+	public:
+		WaiterList() {}
+		// waiters belong to the emitter instance, never copy them
+		WaiterList(const WaiterList&) {}
+		WaiterList& operator=(const WaiterList&) { return *this; }
+		~WaiterList() {
+			for(WaiterNode* node = head; node;) {
+				WaiterNode* next = node->next;
+				node->prev = nullptr;
+				node->next = nullptr;
+				node = next;
+			}
+		}
+		explicit operator bool() const {
+			return head != nullptr;
+		}
+		bool listening() const {
+			return linked.load(std::memory_order_relaxed) != 0;
+		}
+		void push(WaiterNode* node) {
+			linked.fetch_add(1, std::memory_order_relaxed);
+			node->next = head;
+			if(head) {
+				head->prev = &node->next;
+			}
+			head = node;
+			node->prev = &head;
+		}
+		void unlink(WaiterNode* node) {
+			if(!node->prev) {
+				return;
+			}
+			for(Cursor* c = cursors; c; c = c->outer) {
+				if(c->node == node) {
+					c->node = node->next;
+				}
+			}
+			*node->prev = node->next;
+			if(node->next) {
+				node->next->prev = node->prev;
+			}
+			node->prev = nullptr;
+			node->next = nullptr;
+			linked.fetch_sub(1, std::memory_order_relaxed);
+		}
+		// Hands the event to every waiter linked before the call. One-shot
+		// waiters are unlinked. Returns the chain of nodes to resume, so that
+		// locked emitters can resume them after releasing their lock.
+		template<typename... Rest, typename... Args>
+		WaiterNode* notify(Args&&... fargs) {
+			const std::tuple<typename std::decay<Rest>::type...> args(fargs...);
+			WaiterNode* ready = nullptr;
+			WaiterNode** readyTail = &ready;
+			Cursor cursor = { head, cursors };
+			cursors = &cursor;
+			while(WaiterNode* node = cursor.node) {
+				cursor.node = node->next;
+				if(!node->persistent) {
+					unlink(node);
+				}
+				if(node->deliver(node, &args)) {
+					node->ready = nullptr;
+					*readyTail = node;
+					readyTail = &node->ready;
+				}
+			}
+			cursors = cursor.outer;
+			return ready;
+		}
+	};
+
+	inline void resumeWaiters(WaiterNode* ready) {
+		while(ready) {
+			WaiterNode* next = ready->ready;
+			ready->resume(ready);
+			ready = next;
+		}
+	}
+
+	template<typename... Rest> class EventAwaiter;
+	template<typename... Rest> class EventStream;
+	// events a stream keeps for a slow consumer unless told otherwise
+	const size_t defaultStreamCapacity = 64;
+
+#ifdef __EVENTEMITTER_HAS_COROUTINES
+
+	// resumes a coroutine from an executor without allocating
+	struct CoroutineResume : DeferredBase::Resumable {
+		std::coroutine_handle<> handle;
+		CoroutineResume() {
+			run = [](DeferredBase::Resumable* r) {
+				static_cast<CoroutineResume*>(r)->handle.resume();
+			};
+		}
+	};
+
+	// Awaitable returned by nextFoo(); it is registered on creation,
+	// so an event triggered before co_await is not lost.
+	template<typename... Rest>
+	class EventAwaiter : WaiterNode {
+		typedef std::tuple<typename std::decay<Rest>::type...> Result;
+		enum { Waiting, Suspended, Ready };
+		WaiterList* list;
+		LockRef lockRef;
+		DeferredBase* executor;
+		std::atomic<int> state;
+		std::coroutine_handle<> handle;
+		CoroutineResume resumer;
+		alignas(Result) unsigned char storage[sizeof(Result)];
+
+		Result& result() {
+			return *reinterpret_cast<Result*>(storage);
+		}
+		static bool deliverTo(WaiterNode* node, const void* args) {
+			EventAwaiter* self = static_cast<EventAwaiter*>(node);
+			new (self->storage) Result(*static_cast<const Result*>(args));
+			return self->state.exchange(Ready) == Suspended;
+		}
+		static void resumeFrom(WaiterNode* node) {
+			EventAwaiter* self = static_cast<EventAwaiter*>(node);
+			if(self->executor) {
+				self->resumer.handle = self->handle;
+				self->executor->post(self->resumer);
+			}
+			else {
+				self->handle.resume();
+			}
+		}
+	public:
+		// expects lock (if any) to be held by the caller
+		EventAwaiter(WaiterList& list, LockRef lock, DeferredBase* executor) : list(&list), lockRef(lock), executor(executor), state(Waiting) {
+			deliver = &deliverTo;
+			resume = &resumeFrom;
+			list.push(this);
+		}
+		EventAwaiter(const EventAwaiter&) = delete;
+		EventAwaiter& operator=(const EventAwaiter&) = delete;
+		~EventAwaiter() {
+			if(prev) {
+				if(lockRef) {
+					ExclusiveGuard<LockRef> guard(lockRef);
+					list->unlink(this);
+				}
+				else {
+					list->unlink(this);
+				}
+			}
+			if(executor) {
+				executor->withdraw(resumer);
+			}
+			if(state.load() == Ready) {
+				result().~Result();
+			}
+		}
+		bool await_ready() const noexcept {
+			return state.load() == Ready;
+		}
+		bool await_suspend(std::coroutine_handle<> h) noexcept {
+			handle = h;
+			int expected = Waiting;
+			return state.compare_exchange_strong(expected, Suspended);
+		}
+		Result await_resume() {
+			return std::move(result());
+		}
+	};
+
+	// Async generator of events: every trigger is buffered until consumed
+	// with `co_await stream.next()`. The buffer is a ring of capacity
+	// events allocated once with the stream, as the capacity is only known
+	// at run time, and resuming on an executor posts the stream's own
+	// Resumable, so events never allocate. When a trigger finds the ring
+	// full the oldest event is overwritten and counted in lost(), the
+	// trigger never waits for the consumer.
+	template<typename... Rest>
+	class EventStream : WaiterNode {
+		typedef std::tuple<typename std::decay<Rest>::type...> Result;
+		WaiterList* list;
+		LockRef lockRef;
+		DeferredBase* executor;
+		// slots [first, first + count) modulo capacity are constructed
+		Result* ring;
+		size_t capacity;
+		size_t first = 0, count = 0;
+		uint64_t lostEvents = 0;
+		std::coroutine_handle<> handle;
+		CoroutineResume resumer;
+
+		static bool deliverTo(WaiterNode* node, const void* args) {
+			EventStream* self = static_cast<EventStream*>(node);
+			const Result& result = *static_cast<const Result*>(args);
+			if(self->count == self->capacity) {
+				self->ring[self->first] = result;
+				self->first = (self->first + 1) % self->capacity;
+				self->lostEvents++;
+			}
+			else {
+				new (&self->ring[(self->first + self->count) % self->capacity]) Result(result);
+				self->count++;
+			}
+			if(!self->handle) {
+				return false;
+			}
+			self->resumer.handle = self->handle;
+			self->handle = nullptr;
+			return true;
+		}
+		static void resumeFrom(WaiterNode* node) {
+			EventStream* self = static_cast<EventStream*>(node);
+			if(self->executor) {
+				self->executor->post(self->resumer);
+			}
+			else {
+				self->resumer.handle.resume();
+			}
+		}
+		template<typename F> auto locked(F f) -> decltype(f()) {
+			if(lockRef) {
+				ExclusiveGuard<LockRef> guard(lockRef);
+				return f();
+			}
+			return f();
+		}
+	public:
+		class NextAwaiter {
+			EventStream& stream;
+		public:
+			NextAwaiter(EventStream& stream) : stream(stream) {}
+			bool await_ready() const noexcept {
+				return false;
+			}
+			bool await_suspend(std::coroutine_handle<> h) {
+				return stream.locked([&] {
+					if(stream.count) {
+						return false;
+					}
+					stream.handle = h;
+					return true;
+				});
+			}
+			Result await_resume() {
+				return stream.locked([&] {
+					Result& front = stream.ring[stream.first];
+					Result result(std::move(front));
+					front.~Result();
+					stream.first = (stream.first + 1) % stream.capacity;
+					stream.count--;
+					return result;
+				});
+			}
+		};
+
+		// expects lock (if any) to be held by the caller
+		EventStream(WaiterList& list, LockRef lock, DeferredBase* executor, size_t capacity) : list(&list), lockRef(lock), executor(executor), ring(std::allocator<Result>().allocate(std::max<size_t>(capacity, 1))), capacity(std::max<size_t>(capacity, 1)) {
+			persistent = true;
+			deliver = &deliverTo;
+			resume = &resumeFrom;
+			list.push(this);
+		}
+		EventStream(const EventStream&) = delete;
+		EventStream& operator=(const EventStream&) = delete;
+		~EventStream() {
+			if(prev) {
+				locked([&] {
+					list->unlink(this);
+				});
+			}
+			if(executor) {
+				executor->withdraw(resumer);
+			}
+			for(;count;--count) {
+				ring[first].~Result();
+				first = (first + 1) % capacity;
+			}
+			std::allocator<Result>().deallocate(ring, capacity);
+		}
+		NextAwaiter next() {
+			return NextAwaiter(*this);
+		}
+		size_t pending() {
+			return locked([&] {
+				return count;
+			});
+		}
+		// events overwritten because the consumer fell capacity behind
+		uint64_t lost() {
+			return locked([&] {
+				return lostEvents;
+			});
+		}
+	};
+
+#endif // __EVENTEMITTER_HAS_COROUTINES
+	
+	// reference_wrapper needs to be used instead of std::reference_wrapper
+	// this is because of VS2013 (RC) bug
+	template<class T> class reference_wrapper
+	{
+	public:
+		typedef T type;
+		explicit reference_wrapper(T& t): t_(&t) {}
+		operator T& () const { return *t_; }
+		T& get() const { return *t_; }
+		T* get_pointer() const { return t_; }
+private:
+    T* t_;
+};
+	
+
+// source: stackoverflow.com/questions/15501301/binding-function-arguments-in-c11
+template<typename T> struct forward_as_ref_type {
+ typedef T &&type;
+};
+template<typename T> struct forward_as_ref_type<T &> {
+	typedef reference_wrapper<T> type;
+};
+template<typename T> typename forward_as_ref_type<T>::type forward_as_ref(
+ typename std::remove_reference<T>::type &t) {
+    return static_cast<typename forward_as_ref_type<T>::type>(t);
+ }
+ template<typename T> T &&forward_as_ref(
+ typename std::remove_reference<T>::type &&t) {
+    return t;
+ }
+
+template<typename... Args>	
+inline decltype(auto) wrapLambdaWithCallback(const std::function<void(Args...)>& f, std::function<void()>&& afterCb) {
+	return [=,afterCb=std::move(afterCb)](Args&&... args) {
+		f(args...);
+		afterCb();
+	};
+}
+
+template<typename... Args>	
+inline decltype(auto) wrapLambdaWithCallback(std::function<void(Args...)>&& f, std::function<void()>&& afterCb) {
+	return [f=std::move(f),afterCb=std::move(afterCb)](Args&&... args) {
+		f(args...);
+		afterCb();
+	};
+}
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	
+	// TODO: allow callback for setting if async has completed
+	template<typename... Args>
+	class LambdaAsyncWrapper
+	{
+		std::function<void(Args...)> m_f;		
+	public:
+		LambdaAsyncWrapper(const std::function<void(Args...)>& f) : m_f(f) {}
+		void operator()(Args... fargs) const { 
+			auto async = std::async(std::launch::async, m_f, fargs...);
+		}
+	};
+	template<typename... Args>
+	LambdaAsyncWrapper<Args...> wrapLambdaInAsync(const std::function<void(Args...)>& f) {
+		return LambdaAsyncWrapper<Args...>(f);
+	};
+	
+#endif // EVENTEMITTER_DISABLE_THREADING
+
+	class BrokenPromise : public std::runtime_error {
+	public:
+		BrokenPromise() : std::runtime_error("EventEmitter: promise destroyed without a value") {}
+	};
+
+	template<typename T> class Future;
+	template<typename T> class Promise;
+
+	// Shared state of a one-shot Promise/Future pair: a single allocation
+	// holding the value, an optional continuation and the refcounts.
+	template<typename T>
+	class OnceState {
+		template<typename> friend class Future;
+		template<typename> friend class Promise;
+		enum { Pending, Ready, Broken };
+		std::atomic<int> refs;
+		std::atomic<int> promises;
+		int status = Pending;
+		alignas(T) unsigned char storage[sizeof(T)];
+		std::function<void(T&&)> continuation;
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		std::mutex mutex;
+		std::condition_variable condition;
+		int sleepers = 0;
+#else
+		WaiterLock mutex;
+#endif
+
+		OnceState() : refs(2), promises(1) {}
+		~OnceState() {
+			if(status == Ready) {
+				value().~T();
+			}
+		}
+		T& value() {
+			return *reinterpret_cast<T*>(storage);
+		}
+		void release() {
+			if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				delete this;
+			}
+		}
+		template<typename... Args> void settle(int result, Args&&... fargs) {
+			std::function<void(T&&)> then;
+			{
+				WaiterGuard guard(mutex);
+				if(status != Pending) {
+					return;
+				}
+				if(result == Ready) {
+					new (storage) T(std::forward<Args>(fargs)...);
+				}
+				status = result;
+				then.swap(continuation);
+#ifndef EVENTEMITTER_DISABLE_THREADING
+				if(sleepers) {
+					condition.notify_all();
+				}
+#endif
+			}
+			if(then && result == Ready) {
+				then(std::move(value()));
+			}
+		}
+	};
+
+	// Setting side of a one-shot future. Copies share the state; when the
+	// last copy goes away without a value the future reports BrokenPromise.
+	template<typename T>
+	class Promise {
+		template<typename> friend class Future;
+		OnceState<T>* state;
+		explicit Promise(OnceState<T>* state) : state(state) {}
+	public:
+		Promise(const Promise& other) : state(other.state) {
+			state->refs++;
+			state->promises++;
+		}
+		Promise(Promise&& other) : state(other.state) {
+			other.state = nullptr;
+		}
+		Promise& operator=(Promise other) {
+			std::swap(state, other.state);
+			return *this;
+		}
+		~Promise() {
+			if(state) {
+				if(state->promises.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					state->settle(OnceState<T>::Broken);
+				}
+				state->release();
+			}
+		}
+		template<typename... Args> void setValue(Args&&... fargs) {
+			state->settle(OnceState<T>::Ready, std::forward<Args>(fargs)...);
+		}
+		template<typename... Args> void operator()(Args&&... fargs) {
+			setValue(std::forward<Args>(fargs)...);
+		}
+	};
+
+	// Maps the result of a continuation to the value its Future carries,
+	// void continuations produce an empty tuple.
+	template<typename R> struct ContinuationResult {
+		typedef R type;
+		template<typename F, typename T> static void run(Promise<R>& promise, F& f, T&& value) {
+			promise.setValue(f(std::forward<T>(value)));
+		}
+	};
+	template<> struct ContinuationResult<void> {
+		typedef std::tuple<> type;
+		template<typename F, typename T> static void run(Promise<std::tuple<>>& promise, F& f, T&& value) {
+			f(std::forward<T>(value));
+			promise.setValue();
+		}
+	};
+
+	// Lightweight replacement for std::future, set once by a Promise.
+	template<typename T>
+	class Future {
+		template<typename> friend class Future;
+		OnceState<T>* state;
+		explicit Future(OnceState<T>* state) : state(state) {}
+	public:
+		typedef T value_type;
+
+		static std::pair<Promise<T>, Future<T>> create() {
+			OnceState<T>* state = new OnceState<T>();
+			return std::pair<Promise<T>, Future<T>>(Promise<T>(state), Future<T>(state));
+		}
+
+		Future() : state(nullptr) {}
+		Future(Future&& other) : state(other.state) {
+			other.state = nullptr;
+		}
+		Future& operator=(Future&& other) {
+			std::swap(state, other.state);
+			return *this;
+		}
+		Future(const Future&) = delete;
+		Future& operator=(const Future&) = delete;
+		~Future() {
+			if(state) {
+				state->release();
+			}
+		}
+		bool valid() const {
+			return state != nullptr;
+		}
+		bool ready() {
+			WaiterGuard guard(state->mutex);
+			return state->status != OnceState<T>::Pending;
+		}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		template<typename Rep, typename Period>
+		std::future_status wait_for(const std::chrono::duration<Rep, Period>& duration) {
+			std::unique_lock<std::mutex> lk(state->mutex);
+			state->sleepers++;
+			bool done = state->condition.wait_for(lk, duration, [&] {
+				return state->status != OnceState<T>::Pending;
+			});
+			state->sleepers--;
+			return done ? std::future_status::ready : std::future_status::timeout;
+		}
+		void wait() {
+			std::unique_lock<std::mutex> lk(state->mutex);
+			state->sleepers++;
+			state->condition.wait(lk, [&] {
+				return state->status != OnceState<T>::Pending;
+			});
+			state->sleepers--;
+		}
+#else
+		void wait() {
+			if(!ready()) {
+				throw std::logic_error("EventEmitter: waiting for a pending future without threading support");
+			}
+		}
+#endif
+		T get() {
+			wait();
+			OnceState<T>* current = state;
+			state = nullptr;
+			if(current->status == OnceState<T>::Broken) {
+				current->release();
+				throw BrokenPromise();
+			}
+			T result(std::move(current->value()));
+			current->release();
+			return result;
+		}
+		// Runs f with the value once it is set, inline on the thread that
+		// sets it, or right away if it is set already. Returns a future of
+		// the result of f; this future becomes invalid.
+		template<typename F>
+		auto then(F f) -> Future<typename ContinuationResult<decltype(f(std::declval<T>()))>::type> {
+			typedef ContinuationResult<decltype(f(std::declval<T>()))> Result;
+			typedef typename Result::type R;
+			auto chained = Future<R>::create();
+			OnceState<T>* current = state;
+			state = nullptr;
+			Promise<R> promise(std::move(chained.first));
+			std::function<void(T&&)> run = [f, promise](T&& value) mutable {
+				Result::run(promise, f, std::move(value));
+			};
+			bool settled;
+			{
+				WaiterGuard guard(current->mutex);
+				settled = current->status != OnceState<T>::Pending;
+				if(!settled) {
+					current->continuation.swap(run);
+				}
+			}
+			if(settled && current->status == OnceState<T>::Ready) {
+				run(std::move(current->value()));
+			}
+			current->release();
+			return std::move(chained.second);
+		}
+	};
+
+	// 0 is never handed out, it stands for no handler
+	inline handle_id_type& handleCounter() {
+		static handle_id_type counter = 1;
+		return counter;
+	}
+
+	// What trigger does when handlers throw. Every handler runs either way,
+	// and waiters are resumed, before the policy applies.
+	enum class ErrorPolicy : uint8_t {
+		Propagate,	// rethrow the first exception
+		Aggregate,	// throw HandlerErrors with all of them
+		Route		// pass each to the error handler, trigger returns normally
+	};
+
+	class HandlerErrors : public std::runtime_error {
+	public:
+		std::vector<std::exception_ptr> errors;
+		HandlerErrors(std::vector<std::exception_ptr> errors) : std::runtime_error("EventEmitter: handlers threw"), errors(std::move(errors)) {}
+	};
+
+	// Thrown by one handler standing for several, such as a FilterIndex,
+	// when more than one of them threw. The emitter unpacks it, so its
+	// policy applies to each of their exceptions.
+	class SpreadErrors : public HandlerErrors {
+	public:
+		using HandlerErrors::HandlerErrors;
+	};
+
+	// for catch(...) blocks around a handler call
+	inline void collectError(std::vector<std::exception_ptr>& errors) {
+		try {
+			throw;
+		} catch(SpreadErrors& spread) {
+			errors.insert(errors.end(), spread.errors.begin(), spread.errors.end());
+		} catch(...) {
+			errors.push_back(std::current_exception());
+		}
+	}
+
+	typedef std::function<void(std::exception_ptr)> ErrorHandler;
+
+	// Keeps a handler subscribed for its own lifetime. Disconnecting is O(1)
+	// and does not touch the emitter, whose next trigger drops the entry.
+	class ScopedConnection {
+		std::shared_ptr<void> token;
+	public:
+		ScopedConnection() {}
+		explicit ScopedConnection(std::shared_ptr<void> token) : token(std::move(token)) {}
+		ScopedConnection(ScopedConnection&&) = default;
+		ScopedConnection& operator=(ScopedConnection&&) = default;
+		ScopedConnection(const ScopedConnection&) = delete;
+		ScopedConnection& operator=(const ScopedConnection&) = delete;
+		void disconnect() {
+			token.reset();
+		}
+		bool connected() const {
+			return token != nullptr;
+		}
+	};
+
+	// Handler bound to the lifetime of an owner. It is skipped once the
+	// owner is gone and erased by the next trigger.
+	template<typename R, typename... Rest>
+	struct OwnedHandler {
+		std::weak_ptr<void> owner;
+		std::function<R(Rest...)> handler;
+		R operator()(Rest... fargs) {
+			if(auto keep = owner.lock()) {
+				return handler(fargs...);
+			}
+			return R();
+		}
+	};
+
+	// Runs posted work somewhere else: a GUI loop, a pool, ...
+	class Executor {
+	public:
+		virtual ~Executor() {}
+		virtual void execute(std::function<void()> work) = 0;
+	};
+
+	class InlineExecutor : public Executor {
+	public:
+		void execute(std::function<void()> work) override {
+			work();
+		}
+	};
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	// Fixed number of worker threads sharing one queue. Exceptions thrown
+	// by the work are dropped, there is nobody to report them to.
+	class ThreadPool : public Executor {
+		std::mutex m;
+		std::condition_variable condition;
+		std::deque<std::function<void()>> work;
+		bool stopping = false;
+		std::vector<std::thread> threads;
+	public:
+		explicit ThreadPool(unsigned count = std::max(1u, std::thread::hardware_concurrency())) {
+			for(unsigned i = 0;i < count;++i) {
+				threads.emplace_back([this] {
+					std::unique_lock<std::mutex> lk(m);
+					while(true) {
+						condition.wait(lk, [this] {
+							return stopping || !work.empty();
+						});
+						if(work.empty()) {
+							return;
+						}
+						auto next = std::move(work.front());
+						work.pop_front();
+						lk.unlock();
+						try {
+							next();
+						} catch(...) {
+						}
+						lk.lock();
+					}
+				});
+			}
+		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		// one pool for the library's own parallel work, started on first
+		// use and joined at exit
+		static ThreadPool& shared() {
+			static ThreadPool pool;
+			return pool;
+		}
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> guard(m);
+				stopping = true;
+			}
+			condition.notify_all();
+			for(auto& thread : threads) {
+				thread.join();
+			}
+		}
+		void execute(std::function<void()> f) override {
+			{
+				std::lock_guard<std::mutex> guard(m);
+				work.push_back(std::move(f));
+			}
+			condition.notify_one();
+		}
+	};
+#endif
+
+	// Where a bound handler runs: a DeferredBase drained by its owning
+	// thread or any Executor.
+	struct ExecutorRef {
+		void* target;
+		void (*post)(void*, std::function<void()>&&);
+		ExecutorRef(DeferredBase& queue) : target(&queue), post([](void* queue, std::function<void()>&& work) {
+			static_cast<DeferredBase*>(queue)->post(std::move(work));
+		}) {}
+		ExecutorRef(Executor& executor) : target(&executor), post([](void* executor, std::function<void()>&& work) {
+			static_cast<Executor*>(executor)->execute(std::move(work));
+		}) {}
+		void operator()(std::function<void()>&& work) const {
+			post(target, std::move(work));
+		}
+	};
+
+	template<typename... Rest>
+	struct BoundHandler {
+		ExecutorRef executor;
+		std::function<void(Rest...)> handler;
+		void operator()(Rest... fargs) {
+			executor(std::bind(handler, fargs...));
+		}
+	};
+
+	// Bound handlers met by one trigger, grouped per executor and posted
+	// as a single closure each, after the emitter is unlocked.
+	template<typename... Rest>
+	class ExecutorBatches {
+		typedef std::function<void(Rest...)> Handler;
+		typedef std::tuple<typename std::decay<Rest>::type...> ArgsTuple;
+		struct Batch {
+			ExecutorRef executor;
+			std::vector<Handler> handlers;
+		};
+		std::vector<Batch> batches;
+
+		template<size_t... I>
+		static void runAll(std::vector<Handler>& handlers, ArgsTuple& args, std::index_sequence<I...>) {
+			std::exception_ptr first;
+			for(auto& handler : handlers) {
+				try {
+					handler(std::get<I>(args)...);
+				} catch(...) {
+					if(!first) {
+						first = std::current_exception();
+					}
+				}
+			}
+			if(first) {
+				std::rethrow_exception(first);
+			}
+		}
+	public:
+		explicit operator bool() const {
+			return !batches.empty();
+		}
+		void add(const Handler& handler) {
+			add(*handler.template target<BoundHandler<Rest...>>());
+		}
+		void add(const BoundHandler<Rest...>& bound) {
+			for(auto& batch : batches) {
+				if(batch.executor.target == bound.executor.target) {
+					batch.handlers.push_back(bound.handler);
+					return;
+				}
+			}
+			batches.push_back(Batch{bound.executor, {bound.handler}});
+		}
+		template<typename... Args> void post(Args&&... fargs) {
+			auto args = std::make_shared<ArgsTuple>(fargs...);
+			for(auto& batch : batches) {
+				auto handlers = std::make_shared<std::vector<Handler>>(std::move(batch.handlers));
+				batch.executor([handlers, args] {
+					runAll(*handlers, *args, std::index_sequence_for<Rest...>());
+				});
+			}
+			batches.clear();
+		}
+	};
+
+	// Handler storage shared by every emitter flavour, for handlers
+	// returning R. The provider macros below only add the named methods
+	// (onFoo, triggerFoo, ...) forwarding to these, so all the real code is
+	// ordinary templates.
+	template<typename R, typename... Rest>
+	class HandlerList {
+	public:
+		typedef std::function<R(Rest...)> Handler;
+		using Handle = handle_id_type;
+		// id and band share the padding after the callable, a handler
+		// node is the list link plus sizeof(Handler) + 8
+		struct HandlerPtr {
+			Handler handler;
+			Handle id;
+			uint8_t band = static_cast<uint8_t>(Priority::Normal);
+			// Removed: tombstone left by a removal during trigger
+			// Pending: added during trigger, not run until the next one
+			// Once, Owned: erased after the first call / with their owner
+			// Bound: an EventEmitterCore handler run on an executor
+			// plain handlers have no flags, which is all trigger checks
+			uint8_t flags;
+			enum : uint8_t { Removed = 1, Pending = 2, Once = 4, Owned = 8, Bound = 16 };
+			HandlerPtr(Handler handler, bool _specialFlag = false, bool owned = false, bool bound = false) : handler(std::move(handler)), id(handleCounter()++), flags((_specialFlag ? Once : 0) | (owned ? Owned : 0) | (bound ? Bound : 0)) {
+				if(handleCounter() & 0x80000000) {
+					handleCounter() = 1;
+				}
+			}
+			bool specialFlag() {
+				return flags & Once;
+			}
+			bool expired() {
+				if(!(flags & Owned)) {
+					return false;
+				}
+				auto owned = handler.template target<OwnedHandler<R, Rest...>>();
+				return owned && owned->owner.expired();
+			}
+			bool operator==(Handle other) {
+				return id == other;
+			}
+			template<typename... Args> inline decltype(auto) operator() (Args&&... fargs) {
+				return handler(fargs...);
+			}
+			operator Handle() const { return id; }
+		};
+
+	protected:
+		using EventHandlersSet = BandedList<__EVENTEMITTER_CONTAINER>;
+		struct Counter : std::atomic<unsigned> {
+			Counter() : std::atomic<unsigned>(0) {}
+			Counter(const Counter& other) : std::atomic<unsigned>(other.load(std::memory_order_relaxed)) {}
+		};
+		// everything but the pointer to it is allocated on first
+		// subscription, most emitters never get one
+		struct Table {
+			EventHandlersSet eventHandlers;
+			WaiterList waiters;
+			// nesting depth of visit(); while non-zero the list is only
+			// appended to and tombstoned, compacted when it drops to zero
+			unsigned triggering = 0;
+			bool dirty = false;
+			ErrorPolicy errorPolicy = ErrorPolicy::Propagate;
+			ErrorHandler errorHandler;
+			// handlers ever bound to an executor, dispatch only looks for
+			// them when there were some
+			unsigned bound = 0;
+			// handlers not yet removed, so that listening() need not walk
+			// the list nor take the emitter lock
+			Counter live;
+		};
+		// Owns the table. The threaded emitter creates it under its lock
+		// while listening() reads it without, so it is published with an
+		// atomic store and peek() loads it atomically. Everything else
+		// reads it plainly from the thread owning the emitter or under the
+		// lock, which keeps triggers free of atomic loads.
+		class TablePtr {
+			Table* ptr = nullptr;
+		public:
+			TablePtr() {}
+			explicit TablePtr(Table* t) : ptr(t) {}
+			TablePtr(TablePtr&& other) : ptr(other.ptr) {
+				other.ptr = nullptr;
+			}
+			TablePtr& operator=(TablePtr&& other) {
+				Table* t = other.ptr;
+				other.ptr = nullptr;
+				reset(t);
+				return *this;
+			}
+			~TablePtr() {
+				delete ptr;
+			}
+			Table* get() const {
+				return ptr;
+			}
+			Table* peek() const {
+				return __EVENTEMITTER_LOAD_ACQUIRE(ptr);
+			}
+			void reset(Table* t) {
+				Table* old = ptr;
+				__EVENTEMITTER_STORE_RELEASE(ptr, t);
+				delete old;
+			}
+			// points at a table embedded in the owner, which has to
+			// release() it before the table goes away
+			void borrow(Table* t) {
+				ptr = t;
+			}
+			void release() {
+				ptr = nullptr;
+			}
+			Table& operator*() const {
+				return *get();
+			}
+			Table* operator->() const {
+				return get();
+			}
+			explicit operator bool() const {
+				return get() != nullptr;
+			}
+		};
+		TablePtr table;
+
+		Table& ensureTable() {
+			if(!table) {
+				table.reset(new Table());
+			}
+			return *table;
+		}
+		template<typename... Args> Handle add(Priority priority, Args&&... fargs) {
+			Table& t = ensureTable();
+			auto it = t.eventHandlers.emplace(priority, std::forward<Args>(fargs)...);
+			t.live.fetch_add(1, std::memory_order_relaxed);
+			if(t.triggering) {
+				it->flags |= HandlerPtr::Pending;
+				t.dirty = true;
+			}
+			return *it;
+		}
+		void compact() {
+			auto& eventHandlers = table->eventHandlers;
+			auto prev = eventHandlers.before_begin();
+			for(auto i = eventHandlers.begin();i != eventHandlers.end();) {
+				if(i->flags & HandlerPtr::Removed) {
+					i = eventHandlers.erase_after(prev);
+				}
+				else {
+					i->flags &= ~HandlerPtr::Pending;
+					prev = i++;
+				}
+			}
+			table->dirty = false;
+		}
+		struct TriggerScope {
+			Table& t;
+			TriggerScope(Table& t) : t(t) {
+				t.triggering++;
+			}
+			~TriggerScope() {
+				t.triggering--;
+			}
+		};
+	public:
+		HandlerList() {}
+		HandlerList(const HandlerList& other) : table(other.table ? new Table(*other.table) : nullptr) {
+		}
+		HandlerList(HandlerList&&) = default;
+		HandlerList& operator=(const HandlerList& other) {
+			table.reset(other.table ? new Table(*other.table) : nullptr);
+			return *this;
+		}
+		HandlerList& operator=(HandlerList&&) = default;
+	protected:
+		Handle on(Handler handler, Priority priority) {
+			return add(priority, std::move(handler));
+		}
+		Handle once(Handler handler, Priority priority) {
+			return add(priority, std::move(handler), true);
+		}
+		Handle onOwned(std::weak_ptr<void> owner, Handler handler, Priority priority) {
+			return add(priority, OwnedHandler<R, Rest...>{std::move(owner), std::move(handler)}, false, true);
+		}
+		ScopedConnection connect(Handler handler, Priority priority) {
+			auto token = std::make_shared<bool>(true);
+			onOwned(token, std::move(handler), priority);
+			return ScopedConnection(std::move(token));
+		}
+		bool hasHandlers() {
+			Table* t = table.peek();
+			return t && t->live.load(std::memory_order_relaxed) != 0;
+		}
+		int countHandlers() {
+			Table* t = table.peek();
+			return t ? static_cast<int>(t->live.load(std::memory_order_relaxed)) : 0;
+		}
+		// whether handle is subscribed and not removed yet
+		bool hasHandler(Handle handle) {
+			if(!table) {
+				return false;
+			}
+			for(auto& i:table->eventHandlers) {
+				if(i == handle && !(i.flags & HandlerPtr::Removed)) {
+					return true;
+				}
+			}
+			return false;
+		}
+		// Whether a trigger now would reach a handler or a waiter. Safe to
+		// call concurrently with subscriptions; the answer may be stale by
+		// the time the trigger runs.
+		bool listening() const {
+			Table* t = table.peek();
+			return t && (t->live.load(std::memory_order_relaxed) != 0 || t->waiters.listening());
+		}
+		void setErrorPolicy(ErrorPolicy policy, ErrorHandler handler) {
+			Table& t = ensureTable();
+			t.errorPolicy = policy;
+			t.errorHandler = std::move(handler);
+		}
+		// applies the error policy to what visit() caught
+		void raise(std::vector<std::exception_ptr>& errors) {
+			switch(table->errorPolicy) {
+			case ErrorPolicy::Propagate:
+				std::rethrow_exception(errors.front());
+			case ErrorPolicy::Aggregate:
+				throw HandlerErrors(std::move(errors));
+			case ErrorPolicy::Route:
+				if(table->errorHandler) {
+					for(auto& error : errors) {
+						table->errorHandler(error);
+					}
+				}
+				break;
+			}
+		}
+		// Calls call(handler) for each live handler in order until it
+		// returns false, callFlagged for those with once/owned/bound flags.
+		// Exceptions are collected into errors, the caller applies the
+		// policy when it is done.
+		template<typename Call> inline void visit(std::vector<std::exception_ptr>& errors, Call&& call) {
+			visit(errors, call, call);
+		}
+		template<typename Call, typename CallFlagged> inline void visit(std::vector<std::exception_ptr>& errors, Call&& call, CallFlagged&& callFlagged) {
+			Table& t = *table;
+			auto& eventHandlers = t.eventHandlers;
+			{
+				// Handlers may add or remove handlers, or trigger again. Only
+				// the outermost dispatch unlinks nodes, and only the one it
+				// stands on, so no iterator held by an active dispatch dies.
+				TriggerScope scope(t);
+				bool outermost = t.triggering == 1;
+				bool more = true;
+				auto prev = eventHandlers.before_begin(); 
+				for(auto i = eventHandlers.begin();more && i != eventHandlers.end();) {
+					if(!i->flags) {
+						try {
+							more = call(*i);
+						} catch(...) {
+							collectError(errors);
+						}
+						if(!i->flags) {
+							prev = i++;
+							continue;
+						}
+					}
+					else if(!(i->flags & (HandlerPtr::Removed | HandlerPtr::Pending))) {
+						if(i->expired()) {
+							i->flags |= HandlerPtr::Removed;
+							t.live.fetch_sub(1, std::memory_order_relaxed);
+						}
+						else {
+							// a once handler is used up even if it throws
+							if(i->specialFlag()) {
+								i->flags |= HandlerPtr::Removed;
+								t.live.fetch_sub(1, std::memory_order_relaxed);
+							}
+							try {
+								more = callFlagged(*i);
+							} catch(...) {
+								collectError(errors);
+							}
+						}
+					}
+					if(!(i->flags & HandlerPtr::Removed)) {
+						prev = i++;
+					}
+					else if(outermost) {
+						// the call may have subscribed into the band ending
+						// at prev, which puts the new node right after prev
+						while(std::next(prev) != i) {
+							++prev;
+						}
+						i = eventHandlers.erase_after(prev);
+					}
+					else {
+						t.dirty = true;
+						prev = i++;
+					}
+				}
+			}
+			if(t.dirty && !t.triggering) {
+				compact();
+			}
+		}
+		// Read-only visit for callers holding a shared lock, possibly
+		// alongside other triggers. Gives up before calling anything and
+		// returns false when some handler has flags, as those need the
+		// list to be written.
+		template<typename Call> bool visitShared(std::vector<std::exception_ptr>& errors, Call&& call) {
+			auto& eventHandlers = table->eventHandlers;
+			for(auto& i:eventHandlers) {
+				if(i.flags) {
+					return false;
+				}
+			}
+			for(auto& i:eventHandlers) {
+				try {
+					if(!call(i)) {
+						break;
+					}
+				} catch(...) {
+					collectError(errors);
+				}
+			}
+			return true;
+		}
+		bool removeHandler(Handle handlerPtr) {
+			if(!table) {
+				return false;
+			}
+			auto& eventHandlers = table->eventHandlers;
+			auto prev = eventHandlers.before_begin(); 
+			for(auto i = eventHandlers.begin();i != eventHandlers.end();++i,++prev) { 
+				if(*i == handlerPtr && !(i->flags & HandlerPtr::Removed)) {
+					table->live.fetch_sub(1, std::memory_order_relaxed);
+					if(table->triggering) {
+						i->flags |= HandlerPtr::Removed;
+						table->dirty = true;
+					}
+					else {
+						eventHandlers.erase_after(prev);
+					}
+					return true;
+				}
+			}
+			return false;
+		}
+		void clearHandlers() {
+			if(!table) {
+				return;
+			}
+			table->live.store(0, std::memory_order_relaxed);
+			if(table->triggering) {
+				for(auto& i:table->eventHandlers) {
+					i.flags |= HandlerPtr::Removed;
+				}
+				table->dirty = true;
+			}
+			else {
+				table->eventHandlers.clear();
+			}
+		}
+	};
+
+	template<typename... Rest>
+	class EventEmitterCore : public HandlerList<void, Rest...> {
+		typedef HandlerList<void, Rest...> Base;
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::Handle Handle;
+		typedef EventAwaiter<Rest...> Awaiter;
+		typedef EventStream<Rest...> Stream;
+		// whether handlers may be triggered from several threads at once
+		static constexpr bool concurrent = false;
+	protected:
+		WaiterList& waitList() {
+			return this->ensureTable().waiters;
+		}
+		Handle onBound(ExecutorRef executor, Handler handler, Priority priority) {
+			this->ensureTable().bound++;
+			return this->add(priority, BoundHandler<Rest...>{executor, std::move(handler)}, false, false, true);
+		}
+		template<typename... Args> inline void trigger(Args&&... fargs) {
+			std::vector<std::exception_ptr> errors;
+			ExecutorBatches<Rest...> batches;
+			resumeWaiters(dispatch(errors, batches, fargs...));
+			if(batches) {
+				batches.post(fargs...);
+			}
+			if(!errors.empty()) {
+				this->raise(errors);
+			}
+		}
+		// Runs the handlers and hands the event to waiters, returning the
+		// waiters to resume so that locked emitters can do it unlocked.
+		// Exceptions from handlers are collected into errors, the caller
+		// applies the policy once the waiters are resumed.
+		// Handlers bound to executors are collected into batches for the
+		// caller to post.
+		template<typename... Args> inline WaiterNode* dispatch(std::vector<std::exception_ptr>& errors, ExecutorBatches<Rest...>& batches, Args&&... fargs) {
+			if(!this->table) {
+				return nullptr;
+			}
+			auto call = [&](typename Base::HandlerPtr& handler) {
+				handler(fargs...);
+				return true;
+			};
+			if(!this->table->bound) {
+				this->visit(errors, call);
+			}
+			else {
+				this->visit(errors, call, [&](typename Base::HandlerPtr& handler) {
+					if(!(handler.flags & Base::HandlerPtr::Bound)) {
+						handler(fargs...);
+					}
+					else {
+						batches.add(handler.handler);
+					}
+					return true;
+				});
+			}
+			if(!this->table->waiters) {
+				return nullptr;
+			}
+			return this->table->waiters.template notify<Rest...>(fargs...);
+		}
+		// dispatch() for concurrent triggers under a shared lock, false
+		// when it needs the exclusive side instead
+		template<typename... Args> inline bool dispatchShared(std::vector<std::exception_ptr>& errors, Args&&... fargs) {
+			if(!this->table) {
+				return true;
+			}
+			if(this->table->bound || this->table->waiters) {
+				return false;
+			}
+			return this->visitShared(errors, [&](typename Base::HandlerPtr& handler) {
+				handler(fargs...);
+				return true;
+			});
+		}
+		Awaiter next(DeferredBase* executor) {
+			return Awaiter(waitList(), nullptr, executor);
+		}
+		Stream stream(DeferredBase* executor, size_t capacity) {
+			return Stream(waitList(), nullptr, executor, capacity);
+		}
+	};
+
+	// Handlers fixed at compile time as function pointer template
+	// arguments, called directly ahead of the runtime ones. They cannot be
+	// removed, and an exception from one leaves the trigger at once.
+	template<typename Signature, Signature*... Handlers> class StaticEventEmitterCore;
+	template<typename... Rest, void (*... Handlers)(Rest...)>
+	class StaticEventEmitterCore<void(Rest...), Handlers...> : public EventEmitterCore<Rest...> {
+		typedef EventEmitterCore<Rest...> Base;
+	protected:
+		bool hasHandlers() {
+			return sizeof...(Handlers) > 0 || Base::hasHandlers();
+		}
+		int countHandlers() {
+			return static_cast<int>(sizeof...(Handlers)) + Base::countHandlers();
+		}
+		bool listening() const {
+			return sizeof...(Handlers) > 0 || Base::listening();
+		}
+		template<typename... Args> inline void trigger(Args&&... fargs) {
+			int expand[] = {0, (Handlers(fargs...), 0)...};
+			(void)expand;
+			// nothing left to do without runtime subscribers
+			if(this->table) {
+				Base::trigger(fargs...);
+			}
+		}
+	};
+
+	// Behavior mode for a core: the last Depth events are kept and
+	// replayed to every new subscriber when it subscribes. The replay runs
+	// after the handler is registered, so an event triggered meanwhile may
+	// reach it twice, but the last event it sees is always the latest.
+	template<typename Core, size_t Depth, typename... Rest>
+	class StickyCore : public Core {
+	public:
+		typedef typename Core::Handler Handler;
+		typedef typename Core::Handle Handle;
+		typedef typename StickyHistory<Depth, Rest...>::Args Args;
+	private:
+		StickyHistory<Depth, Rest...> history;
+
+		void replay(Handler& handler) {
+			if(history.empty()) {
+				return;
+			}
+			Args packs[Depth];
+			size_t count = history.snapshot(packs);
+			for(size_t i = 0;i < count;++i) {
+				applyTuple(handler, packs[i], std::index_sequence_for<Rest...>());
+			}
+		}
+	protected:
+		Handle on(Handler handler, Priority priority) {
+			Handle handle = Core::on(handler, priority);
+			replay(handler);
+			return handle;
+		}
+		// gets the latest event if there is one, otherwise the next;
+		// 0 when the replay used it up
+		Handle once(Handler handler, Priority priority) {
+			Handle handle = Core::once(handler, priority);
+			if(!history.empty() && Core::removeHandler(handle)) {
+				Args packs[Depth];
+				size_t count = history.snapshot(packs);
+				applyTuple(handler, packs[count - 1], std::index_sequence_for<Rest...>());
+				return 0;
+			}
+			return handle;
+		}
+		Handle onOwned(std::weak_ptr<void> owner, Handler handler, Priority priority) {
+			Handle handle = Core::onOwned(owner, handler, priority);
+			if(auto keep = owner.lock()) {
+				replay(handler);
+			}
+			return handle;
+		}
+		Handle onBound(ExecutorRef executor, Handler handler, Priority priority) {
+			Handle handle = Core::onBound(executor, handler, priority);
+			if(!history.empty()) {
+				auto packs = std::make_shared<std::array<Args, Depth>>();
+				size_t count = history.snapshot(packs->data());
+				executor([handler, packs, count] {
+					for(size_t i = 0;i < count;++i) {
+						applyTuple(handler, (*packs)[i], std::index_sequence_for<Rest...>());
+					}
+				});
+			}
+			return handle;
+		}
+		ScopedConnection connect(Handler handler, Priority priority) {
+			auto token = std::make_shared<bool>(true);
+			onOwned(token, std::move(handler), priority);
+			return ScopedConnection(std::move(token));
+		}
+		template<typename... Args> void trigger(Args&&... fargs) {
+			history.record(fargs...);
+			Core::trigger(std::forward<Args>(fargs)...);
+		}
+		// every event is kept for later subscribers
+		bool listening() const {
+			return true;
+		}
+		// copies the latest event into out, false if there was none
+		bool last(Args& out) {
+			if(history.empty()) {
+				return false;
+			}
+			Args packs[Depth];
+			size_t count = history.snapshot(packs);
+			out = packs[count - 1];
+			return true;
+		}
+	};
+
+	// Events are queued on trigger and run from runDeferred()/runAllDeferred().
+	template<typename... Rest>
+	class DeferredEventEmitterCore : public EventEmitterCore<Rest...>, private DeferredBase::RemoveHook, public virtual DeferredBase {
+		typedef EventEmitterCore<Rest...> Base;
+		typedef DeferredBase::RemoveHook Hook;
+		static void clearAll(Hook* hook) {
+			static_cast<DeferredEventEmitterCore*>(hook)->clearHandlers();
+		}
+	protected:
+		DeferredEventEmitterCore() {
+			addRemoveHook(this, &clearAll);
+		}
+		DeferredEventEmitterCore(const DeferredEventEmitterCore& other) : Base(other), Hook() {
+			addRemoveHook(this, &clearAll);
+		}
+		DeferredEventEmitterCore& operator=(const DeferredEventEmitterCore& other) {
+			Base::operator=(other);
+			return *this;
+		}
+		template<typename... Args> void triggerByRef(Args&&... fargs) {
+			runDeferred(
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND Base::trigger(as...);
+				}, forward_as_ref<Args>(fargs)...));
+		}
+		template<typename... Args> void trigger(Args... fargs) {
+			triggerWithPriority(Priority::Normal, fargs...);
+		}
+		template<typename... Args> void triggerWithPriority(Priority priority, Args... fargs) {
+			runDeferred(
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND Base::trigger(as...);
+				}, fargs...), priority);
+		}
+		template<typename... Args> TimerHandle triggerAt(std::chrono::steady_clock::time_point when, Args... fargs) {
+			return runDeferredAt(when,
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND Base::trigger(as...);
+				}, fargs...));
+		}
+		template<typename... Args> TimerHandle triggerAfter(std::chrono::steady_clock::duration delay, Args... fargs) {
+			return triggerAt(std::chrono::steady_clock::now() + delay, fargs...);
+		}
+	};
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	// Mutex protected emitter which can also defer, wait for events and
+	// hand out futures.
+	template<typename... Rest>
+	class ThreadedEventEmitterCore : public EventEmitterCore<Rest...>, private DeferredBase::RemoveHook, public virtual DeferredBase {
+		typedef EventEmitterCore<Rest...> Base;
+		// only needed by wait(), created there under the emitter mutex
+		struct WaitState {
+			std::condition_variable condition;
+			std::mutex m;
+		};
+		std::unique_ptr<WaitState> waitState;
+
+		typedef DeferredBase::RemoveHook Hook;
+		static void clearAll(Hook* hook) {
+			auto self = static_cast<ThreadedEventEmitterCore*>(hook);
+			std::lock_guard<std::mutex> guard(self->lock());
+			self->Base::clearHandlers();
+		}
+		// the handler list mutex lives next to the deferred queue, both
+		// allocated on first use
+		std::mutex& lock() {
+			return this->state().handlersMutex;
+		}
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::HandlerPtr HandlerPtr;
+		typedef typename Base::Handle Handle;
+		typedef typename Base::Awaiter Awaiter;
+		typedef typename Base::Stream Stream;
+		static constexpr bool concurrent = true;
+	protected:
+		ThreadedEventEmitterCore() {
+			addRemoveHook(this, &clearAll);
+		}
+		ThreadedEventEmitterCore(const ThreadedEventEmitterCore& other) : Base(other), Hook() {
+			addRemoveHook(this, &clearAll);
+		}
+		ThreadedEventEmitterCore& operator=(const ThreadedEventEmitterCore& other) {
+			Base::operator=(other);
+			return *this;
+		}
+		bool wait(std::chrono::milliseconds duration) {
+			return wait([=](Rest...) {
+			}, duration);
+		}
+		bool wait(Handler handler, std::chrono::milliseconds duration) {
+			std::shared_ptr<std::atomic<bool>> finished = std::make_shared<std::atomic<bool>>(false);
+			WaitState* w;
+			{
+				std::lock_guard<std::mutex> guard(lock());
+				if(!waitState) {
+					waitState.reset(new WaitState());
+				}
+				w = waitState.get();
+			}
+			// registered before taking w->m, the handler takes it while
+			// trigger holds the emitter mutex
+			Handle ptr = once(
+				wrapLambdaWithCallback(handler, [=]() {
+					finished->store(true);
+					{
+						std::lock_guard<std::mutex> waiting(w->m);
+					}
+					w->condition.notify_all();
+			}), Priority::Normal);
+			
+			std::unique_lock<std::mutex> lk(w->m);
+			if(duration == std::chrono::milliseconds::max()) {
+				w->condition.wait(lk, [=]() {
+					return finished->load();
+				});
+			} 
+			else {
+				w->condition.wait_for(lk, duration, [=]() {
+					return finished->load();
+				});
+			}
+			lk.unlock();
+			bool gotFinished = finished->load();
+			if(!gotFinished) {
+				std::lock_guard<std::mutex> guard(lock());
+				Base::removeHandler(ptr);
+			}
+			return gotFinished;
+		}
+		void asyncWait(Handler handler, std::chrono::milliseconds duration, const std::function<void()>& asyncTimeout) {
+			auto async = std::async(std::launch::async, [this, handler, duration, asyncTimeout]() {
+				if(!wait(handler, duration))
+					asyncTimeout();
+			});
+		}
+		Handle on(Handler handler, Priority priority) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::on(std::move(handler), priority);
+		}
+		Handle once(Handler handler, Priority priority) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::once(std::move(handler), priority);
+		}
+		Handle onOwned(std::weak_ptr<void> owner, Handler handler, Priority priority) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::onOwned(std::move(owner), std::move(handler), priority);
+		}
+		Handle onBound(ExecutorRef executor, Handler handler, Priority priority) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::onBound(executor, std::move(handler), priority);
+		}
+		ScopedConnection connect(Handler handler, Priority priority) {
+			auto token = std::make_shared<bool>(true);
+			onOwned(token, std::move(handler), priority);
+			return ScopedConnection(std::move(token));
+		}
+		bool hasHandler(Handle handle) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::hasHandler(handle);
+		}
+		bool removeHandler(Handle handle) {
+			std::lock_guard<std::mutex> guard(lock());
+			return Base::removeHandler(handle);
+		}
+		void clearHandlers() {
+			std::lock_guard<std::mutex> guard(lock());
+			Base::clearHandlers();
+		}
+		void setErrorPolicy(ErrorPolicy policy, ErrorHandler handler) {
+			std::lock_guard<std::mutex> guard(lock());
+			Base::setErrorPolicy(policy, std::move(handler));
+		}
+		Handle asyncOn(Handler handler) {
+			return on(wrapLambdaInAsync(handler), Priority::Normal);
+		}
+		Handle asyncOnce(Handler handler) {
+			return once(wrapLambdaInAsync(handler), Priority::Normal);
+		}
+		Future<std::tuple<Rest...>> futureOnce() {
+			auto pair = Future<std::tuple<Rest...>>::create();
+			Promise<std::tuple<Rest...>> promise(std::move(pair.first));
+			once([promise](Rest... fargs) mutable {
+				promise.setValue(fargs...);
+			}, Priority::Normal);
+			return std::move(pair.second);
+		}
+		template<typename... Args> void trigger(Args&&... fargs) { 
+			// nothing was ever subscribed without creating the state
+			State* s = this->peekState();
+			if(!s) {
+				return;
+			}
+			std::vector<std::exception_ptr> errors;
+			ExecutorBatches<Rest...> batches;
+			WaiterNode* ready;
+			{
+				std::lock_guard<std::mutex> guard(s->handlersMutex);
+				ready = Base::dispatch(errors, batches, fargs...);
+			}
+			resumeWaiters(ready);
+			if(batches) {
+				batches.post(fargs...);
+			}
+			if(!errors.empty()) {
+				Base::raise(errors);
+			}
+		}
+		Awaiter next(DeferredBase* executor) {
+			std::mutex& m = lock();
+			std::lock_guard<std::mutex> guard(m);
+			return Awaiter(this->waitList(), &m, executor);
+		}
+		Stream stream(DeferredBase* executor, size_t capacity) {
+			std::mutex& m = lock();
+			std::lock_guard<std::mutex> guard(m);
+			return Stream(this->waitList(), &m, executor, capacity);
+		}
+		template<typename... Args> void deferByRef(Args&&... fargs) { 
+			runDeferred(
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND trigger(as...);
+				}, forward_as_ref<Args>(fargs)...));
+		}
+		template<typename... Args> void defer(Args... fargs) { 
+			deferWithPriority(Priority::Normal, fargs...);
+		}
+		template<typename... Args> void deferWithPriority(Priority priority, Args... fargs) { 
+			runDeferred(
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND trigger(as...);
+				}, fargs...), priority);
+		}
+		template<typename... Args> TimerHandle deferAt(std::chrono::steady_clock::time_point when, Args... fargs) {
+			return runDeferredAt(when,
+				std::bind([this](Args... as) {
+				__EVENTEMITTER_GCC_WORKAROUND trigger(as...);
+				}, fargs...));
+		}
+		template<typename... Args> TimerHandle deferAfter(std::chrono::steady_clock::duration delay, Args... fargs) {
+			return deferAt(std::chrono::steady_clock::now() + delay, fargs...);
+		}
+	};
+#endif // EVENTEMITTER_DISABLE_THREADING
+
+	// EventEmitterCore guarded by a lock policy of its own, without the
+	// deferred queue: NullLock, SpinLock, MutexLock or SharedLock. With
+	// SharedLock triggers run concurrently under the shared side as long
+	// as no handler is once, owned or bound and nobody awaits the event.
+	template<typename Lock, typename... Rest>
+	class LockedEventEmitterCore : public EventEmitterCore<Rest...> {
+		typedef EventEmitterCore<Rest...> Base;
+		Lock m;
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::HandlerPtr HandlerPtr;
+		typedef typename Base::Handle Handle;
+		typedef typename Base::Awaiter Awaiter;
+		typedef typename Base::Stream Stream;
+		static constexpr bool concurrent = !std::is_same<Lock, NullLock>::value;
+	protected:
+		LockedEventEmitterCore() {}
+		// the lock is not copied
+		LockedEventEmitterCore(const LockedEventEmitterCore& other) : Base(other) {}
+		LockedEventEmitterCore& operator=(const LockedEventEmitterCore& other) {
+			Base::operator=(other);
+			return *this;
+		}
+		Handle on(Handler handler, Priority priority) {
+			ExclusiveGuard<Lock> guard(m);
+			return Base::on(std::move(handler), priority);
+		}
+		Handle once(Handler handler, Priority priority) {
+			ExclusiveGuard<Lock> guard(m);
+			return Base::once(std::move(handler), priority);
+		}
+		Handle onOwned(std::weak_ptr<void> owner, Handler handler, Priority priority) {
+			ExclusiveGuard<Lock> guard(m);
+			return Base::onOwned(std::move(owner), std::move(handler), priority);
+		}
+		Handle onBound(ExecutorRef executor, Handler handler, Priority priority) {
+			ExclusiveGuard<Lock> guard(m);
+			return Base::onBound(executor, std::move(handler), priority);
+		}
+		ScopedConnection connect(Handler handler, Priority priority) {
+			auto token = std::make_shared<bool>(true);
+			onOwned(token, std::move(handler), priority);
+			return ScopedConnection(std::move(token));
+		}
+		void setErrorPolicy(ErrorPolicy policy, ErrorHandler handler) {
+			ExclusiveGuard<Lock> guard(m);
+			Base::setErrorPolicy(policy, std::move(handler));
+		}
+		bool hasHandlers() {
+			SharedGuard<Lock> guard(m);
+			return Base::hasHandlers();
+		}
+		int countHandlers() {
+			SharedGuard<Lock> guard(m);
+			return Base::countHandlers();
+		}
+		bool hasHandler(Handle handle) {
+			SharedGuard<Lock> guard(m);
+			return Base::hasHandler(handle);
+		}
+		bool removeHandler(Handle handlerPtr) {
+			ExclusiveGuard<Lock> guard(m);
+			return Base::removeHandler(handlerPtr);
+		}
+		void clearHandlers() {
+			ExclusiveGuard<Lock> guard(m);
+			Base::clearHandlers();
+		}
+		template<typename... Args> void trigger(Args&&... fargs) {
+			std::vector<std::exception_ptr> errors;
+			bool done = false;
+			if(Lock::shared) {
+				SharedGuard<Lock> guard(m);
+				done = Base::dispatchShared(errors, fargs...);
+			}
+			if(!done) {
+				ExecutorBatches<Rest...> batches;
+				WaiterNode* ready;
+				{
+					ExclusiveGuard<Lock> guard(m);
+					ready = Base::dispatch(errors, batches, fargs...);
+				}
+				resumeWaiters(ready);
+				if(batches) {
+					batches.post(fargs...);
+				}
+			}
+			if(!errors.empty()) {
+				Base::raise(errors);
+			}
+		}
+		Awaiter next(DeferredBase* executor) {
+			ExclusiveGuard<Lock> guard(m);
+			return Awaiter(this->waitList(), &m, executor);
+		}
+		Stream stream(DeferredBase* executor, size_t capacity) {
+			ExclusiveGuard<Lock> guard(m);
+			return Stream(this->waitList(), &m, executor, capacity);
+		}
+	};
+
+#ifdef __EVENTEMITTER_HAS_SHM
+	// trigger() publishes into a SharedRing, receive() runs the local
+	// handlers for events published by any process.
+	template<typename... Rest>
+	class SharedMemoryEventEmitterCore : public EventEmitterCore<Rest...> {
+		static_assert(AllTriviallyCopyable<Rest...>::value, "shared memory events need trivially copyable arguments");
+		typedef EventEmitterCore<Rest...> Base;
+		typedef PackedArgs<typename std::decay<Rest>::type...> Payload;
+		SharedRing ring;
+
+		template<size_t... I> void dispatchPacked(Payload& payload, std::index_sequence<I...>) {
+			Base::trigger(PackedGet<I>::get(payload)...);
+		}
+		size_t drain() {
+			size_t count = 0;
+			Payload payload;
+			while(ring.consume(&payload)) {
+				dispatchPacked(payload, std::index_sequence_for<Rest...>());
+				count++;
+			}
+			return count;
+		}
+	public:
+		SharedMemoryEventEmitterCore(const std::string& shmName, size_t capacity = 4096) : ring(shmName, sizeof(Payload), capacity) {
+		}
+	protected:
+		template<typename... Args> void trigger(Args&&... fargs) {
+			Payload payload;
+			packArgs(payload, std::forward<Args>(fargs)...);
+			ring.publish(&payload);
+		}
+		size_t receive(std::chrono::microseconds timeout) {
+			size_t count = drain();
+			if(!count && timeout > std::chrono::microseconds::zero() && ring.wait(timeout)) {
+				count = drain();
+			}
+			return count;
+		}
+		uint64_t lostEvents() const {
+			return ring.lost();
+		}
+		// other processes may be listening
+		bool listening() const {
+			return true;
+		}
+	};
+#endif // __EVENTEMITTER_HAS_SHM
+
+	// Handlers keyed by the first event argument, used by the dispatchers.
+	template<typename T, typename... Rest>
+	class DispatchTable {
+	public:
+		typedef typename EventEmitterCore<Rest...>::Handler Handler;
+		typedef typename EventEmitterCore<Rest...>::Handle Handle;
+		typedef typename EventEmitterCore<Rest...>::HandlerPtr HandlerPtr;
+	private:
+		std::multimap<T, HandlerPtr> map;
+		bool eraseLast = false;
+	public:
+		template<typename... Args> void dispatch(const T& eventName, Args&&... fargs) {
+ 			auto ret = map.equal_range(eventName);
+ 			for(auto it = ret.first;it != ret.second;) {
+ 				(it->second)(fargs...);
+				if(eraseLast) {
+					it = map.erase(it);
+					eraseLast = false;
+				}
+				else {
+					++it;
+				}
+ 			}
+		}
+		bool has(const T& eventName) {
+			return map.find(eventName) != map.end();
+		}
+		bool listening(const T& eventName) {
+			return has(eventName);
+		}
+		int count(const T& eventName) {
+			int count = 0;
+			auto ret = map.equal_range(eventName);
+			for(auto it = ret.first;it != ret.second;++it)
+				count++;
+			return count;
+		}
+		Handle on(T eventName, Handler handler) {
+			return map.insert(std::pair<T, Handler>(eventName,  handler))->second;
+		}
+		Handle once(T eventName, Handler handler) {
+			return map.insert(std::pair<T, Handler>(eventName,  
+				wrapLambdaWithCallback(handler, [&] {
+					eraseLast = true;
+				})))->second;
+		}
+		bool remove(const T& eventName, Handle handler) {
+			auto ret = map.equal_range(eventName);
+			for(auto it = ret.first;it != ret.second;++it) {
+				if(it->second == handler) {
+					it = map.erase(it);
+					return true;
+				}
+			}
+			return false;
+		}
+		void removeAll(const T& eventName) {
+			auto ret = map.equal_range(eventName);
+			for(auto it = ret.first;it != ret.second;) {		
+				it = map.erase(it);
+			}
+		}
+	};
+
+	// DispatchTable for deferred dispatchers: each event name is interned
+	// once into a bucket of handlers with a stable index, so a deferred
+	// trigger resolves the name when it is queued and the queue only holds
+	// the index and the arguments. Names without handlers resolve to npos.
+	template<typename T, typename... Rest>
+	class InternedDispatchTable {
+	public:
+		typedef typename EventEmitterCore<Rest...>::Handler Handler;
+		typedef typename EventEmitterCore<Rest...>::Handle Handle;
+		typedef typename EventEmitterCore<Rest...>::HandlerPtr HandlerPtr;
+		static const uint32_t npos = static_cast<uint32_t>(-1);
+	private:
+		struct Bucket {
+			// the interned name, owned by ids
+			const T* name;
+			std::vector<HandlerPtr> handlers;
+			// subscribed while the bucket dispatches, appended afterwards
+			// so that handlers never move under a running call
+			std::vector<HandlerPtr> added;
+			size_t live = 0;
+			// nesting depth of dispatch(); while non-zero removals only
+			// tombstone, settled when it drops to zero
+			unsigned triggering = 0;
+			bool dirty = false;
+		};
+		struct DispatchScope {
+			Bucket& b;
+			DispatchScope(Bucket& b) : b(b) {
+				b.triggering++;
+			}
+			~DispatchScope() {
+				if(!--b.triggering) {
+					settle(b);
+				}
+			}
+		};
+		std::map<T, uint32_t> ids;
+		std::deque<Bucket> buckets;
+
+		static void settle(Bucket& b) {
+			if(b.dirty) {
+				b.handlers.erase(std::remove_if(b.handlers.begin(), b.handlers.end(), [](HandlerPtr& handler) {
+					return handler.flags & HandlerPtr::Removed;
+				}), b.handlers.end());
+				b.dirty = false;
+			}
+			if(!b.added.empty()) {
+				std::move(b.added.begin(), b.added.end(), std::back_inserter(b.handlers));
+				b.added.clear();
+			}
+		}
+		Handle add(T eventName, Handler handler, bool once) {
+			Bucket& b = buckets[intern(std::move(eventName))];
+			auto& handlers = b.triggering ? b.added : b.handlers;
+			handlers.emplace_back(std::move(handler), once);
+			b.live++;
+			return handlers.back();
+		}
+
+		Bucket* bucket(const T& eventName) {
+			auto it = ids.find(eventName);
+			return it == ids.end() ? nullptr : &buckets[it->second];
+		}
+		uint32_t intern(T eventName) {
+			auto it = ids.find(eventName);
+			if(it == ids.end()) {
+				it = ids.emplace(std::move(eventName), static_cast<uint32_t>(buckets.size())).first;
+				buckets.emplace_back();
+				buckets.back().name = &it->first;
+			}
+			return it->second;
+		}
+	public:
+		// Deferred call of one event, holds no copy of the name.
+		struct Call {
+			InternedDispatchTable* table;
+			uint32_t id;
+			std::tuple<typename std::decay<Rest>::type...> args;
+			void operator()() {
+				run(std::index_sequence_for<Rest...>());
+			}
+			template<size_t... I> void run(std::index_sequence<I...>) {
+				table->dispatch(id, std::get<I>(args)...);
+			}
+		};
+		uint32_t find(const T& eventName) {
+			auto it = ids.find(eventName);
+			if(it == ids.end() || !buckets[it->second].live) {
+				return npos;
+			}
+			return it->second;
+		}
+		// Handlers may subscribe to or remove handlers of the name they run
+		// for; those subscribed meanwhile first run on the next dispatch.
+		template<typename... Args> void dispatch(uint32_t id, Args&&... fargs) {
+			Bucket& b = buckets[id];
+			DispatchScope scope(b);
+			size_t count = b.handlers.size();
+			for(size_t i = 0;i < count;++i) {
+				HandlerPtr& handler = b.handlers[i];
+				if(handler.flags & HandlerPtr::Removed) {
+					continue;
+				}
+				// a once handler is used up even if it throws
+				if(handler.specialFlag()) {
+					handler.flags |= HandlerPtr::Removed;
+					b.live--;
+					b.dirty = true;
+				}
+				handler(fargs...);
+			}
+		}
+		template<typename... Args> void dispatch(const T& eventName, Args&&... fargs) {
+			uint32_t id = find(eventName);
+			if(id != npos) {
+				dispatch(id, std::forward<Args>(fargs)...);
+			}
+		}
+		bool has(const T& eventName) {
+			return find(eventName) != npos;
+		}
+		int count(const T& eventName) {
+			Bucket* b = bucket(eventName);
+			return b ? static_cast<int>(b->live) : 0;
+		}
+		Handle on(T eventName, Handler handler) {
+			return add(std::move(eventName), std::move(handler), false);
+		}
+		Handle once(T eventName, Handler handler) {
+			return add(std::move(eventName), std::move(handler), true);
+		}
+		bool remove(const T& eventName, Handle handler) {
+			Bucket* b = bucket(eventName);
+			if(!b) {
+				return false;
+			}
+			for(auto it = b->added.begin();it != b->added.end();++it) {
+				if(*it == handler) {
+					b->added.erase(it);
+					b->live--;
+					return true;
+				}
+			}
+			for(auto it = b->handlers.begin();it != b->handlers.end();++it) {
+				if(*it == handler && !(it->flags & HandlerPtr::Removed)) {
+					if(b->triggering) {
+						it->flags |= HandlerPtr::Removed;
+						b->dirty = true;
+					}
+					else {
+						b->handlers.erase(it);
+					}
+					b->live--;
+					return true;
+				}
+			}
+			return false;
+		}
+		void removeAll(const T& eventName) {
+			Bucket* b = bucket(eventName);
+			if(!b) {
+				return;
+			}
+			b->added.clear();
+			b->live = 0;
+			if(b->triggering) {
+				for(auto& handler : b->handlers) {
+					handler.flags |= HandlerPtr::Removed;
+				}
+				b->dirty = true;
+			}
+			else {
+				b->handlers.clear();
+			}
+		}
+	};
+
+	// DispatchTable keeping a StickyHistory per event name and replaying it
+	// to handlers subscribing to that name.
+	template<size_t Depth, typename T, typename... Rest>
+	class StickyDispatchTable : public DispatchTable<T, Rest...> {
+		typedef DispatchTable<T, Rest...> Base;
+		typedef typename StickyHistory<Depth, Rest...>::Args Args;
+		std::unordered_map<T, StickyHistory<Depth, Rest...>> histories;
+		// the dispatcher may run on a threaded emitter, whose trigger
+		// records while other threads subscribe; histories never move
+		__EVENTEMITTER_MUTEX_DECLARE(historiesMutex)
+
+		StickyHistory<Depth, Rest...>* history(const T& eventName, bool create) {
+			__EVENTEMITTER_LOCK_GUARD(historiesMutex);
+			if(create) {
+				return &histories[eventName];
+			}
+			auto it = histories.find(eventName);
+			return it == histories.end() ? nullptr : &it->second;
+		}
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::Handle Handle;
+		template<typename... Args> void dispatch(const T& eventName, Args&&... fargs) {
+			history(eventName, true)->record(fargs...);
+			Base::dispatch(eventName, std::forward<Args>(fargs)...);
+		}
+		bool listening(const T&) {
+			return true;
+		}
+		Handle on(T eventName, Handler handler) {
+			auto kept = history(eventName, false);
+			Handle handle = Base::on(std::move(eventName), handler);
+			if(kept) {
+				Args packs[Depth];
+				size_t count = kept->snapshot(packs);
+				for(size_t i = 0;i < count;++i) {
+					applyTuple(handler, packs[i], std::index_sequence_for<Rest...>());
+				}
+			}
+			return handle;
+		}
+		// A once handler the history satisfies right away is never
+		// registered, 0 is returned instead of a handle then.
+		Handle once(T eventName, Handler handler) {
+			auto kept = history(eventName, false);
+			if(!kept) {
+				return Base::once(std::move(eventName), std::move(handler));
+			}
+			Args packs[Depth];
+			size_t count = kept->snapshot(packs);
+			applyTuple(handler, packs[count - 1], std::index_sequence_for<Rest...>());
+			return 0;
+		}
+	};
+
+	template<typename Key, typename... Rest> class FilterIndex;
+
+	// Declarative condition on the key a FilterIndex projects out of the
+	// event: equal to lo, or within [lo, hi].
+	template<typename Key, typename... Rest>
+	struct Filter {
+		FilterIndex<Key, Rest...>* index;
+		Key lo, hi;
+		bool range;
+	};
+
+	// Handlers filtered on one key projected from the event arguments,
+	// such as a symbol or a price. Equality filters sit in a hash map, so a
+	// trigger only calls the handlers whose filters match. Range filters
+	// are kept sorted by lower bound with the upper bounds in one
+	// contiguous array, which is all a trigger reads for the candidates.
+	// Subscribe with onFoo(index.equals(key), handler), which hooks the
+	// index up to that emitter the first time, at normal priority.
+	// Handlers may trigger, subscribe and remove while they run: those
+	// subscriptions are filed once no trigger runs and removals leave
+	// tombstones. Once attached to a threaded or locked emitter the index
+	// takes references to the matching handlers under its lock and calls
+	// them unlocked, otherwise triggers take no lock at all. Every match
+	// runs even when one throws, the emitter's error policy then applies
+	// to each exception.
+	template<typename Key, typename... Rest>
+	class FilterIndex {
+	public:
+		typedef typename EventEmitterCore<Rest...>::Handler Handler;
+		typedef typename EventEmitterCore<Rest...>::Handle Handle;
+		typedef typename EventEmitterCore<Rest...>::HandlerPtr HandlerPtr;
+	private:
+		// shared so that a locked trigger keeps what it matched alive
+		// without copying the callable
+		typedef std::shared_ptr<HandlerPtr> Node;
+		struct Added {
+			Filter<Key, Rest...> filter;
+			Node handler;
+		};
+		struct Source {
+			const void* emitter;
+			Handle handle;
+		};
+		struct DispatchScope {
+			FilterIndex& index;
+			DispatchScope(FilterIndex& index) : index(index) {
+				index.triggering++;
+			}
+			~DispatchScope() {
+				if(!--index.triggering) {
+					index.settle();
+				}
+			}
+		};
+		std::function<Key(const Rest&...)> projection;
+		std::unordered_map<Key, std::vector<Node>> exact;
+		std::vector<Key> los, his;
+		std::vector<Node> ranged;
+		// subscribed while a trigger runs, filed afterwards so that
+		// handlers never move under a running call
+		std::vector<Added> added;
+		// the handle each emitter runs the index under
+		std::vector<Source> sources;
+		// nesting depth of unlocked triggers; while non-zero removals only
+		// tombstone, settled when it drops to zero
+		unsigned triggering = 0;
+		bool dirty = false;
+		// attached to an emitter triggered from several threads
+		std::atomic<bool> locked;
+		WaiterLock m;
+
+		template<typename F> void match(const Key& key, F f) {
+			if(!exact.empty()) {
+				auto it = exact.find(key);
+				if(it != exact.end()) {
+					for(auto& handler : it->second) {
+						if(!(handler->flags & HandlerPtr::Removed)) {
+							f(handler);
+						}
+					}
+				}
+			}
+			size_t candidates = std::upper_bound(los.begin(), los.end(), key) - los.begin();
+			for(size_t i = 0;i < candidates;++i) {
+				if(!(his[i] < key) && !(ranged[i]->flags & HandlerPtr::Removed)) {
+					f(ranged[i]);
+				}
+			}
+		}
+		Handle file(const Filter<Key, Rest...>& filter, Node handler) {
+			if(!filter.range) {
+				auto& handlers = exact[filter.lo];
+				handlers.push_back(std::move(handler));
+				return *handlers.back();
+			}
+			size_t at = std::upper_bound(los.begin(), los.end(), filter.lo) - los.begin();
+			los.insert(los.begin() + at, filter.lo);
+			his.insert(his.begin() + at, filter.hi);
+			return **ranged.insert(ranged.begin() + at, std::move(handler));
+		}
+		void settle() {
+			if(dirty) {
+				auto removed = [](const Node& handler) {
+					return handler->flags & HandlerPtr::Removed;
+				};
+				for(auto it = exact.begin();it != exact.end();) {
+					auto& handlers = it->second;
+					handlers.erase(std::remove_if(handlers.begin(), handlers.end(), removed), handlers.end());
+					it = handlers.empty() ? exact.erase(it) : std::next(it);
+				}
+				size_t kept = 0;
+				for(size_t i = 0;i < ranged.size();++i) {
+					if(!removed(ranged[i])) {
+						los[kept] = los[i];
+						his[kept] = his[i];
+						ranged[kept++] = std::move(ranged[i]);
+					}
+				}
+				los.resize(kept);
+				his.resize(kept);
+				ranged.erase(ranged.begin() + kept, ranged.end());
+				dirty = false;
+			}
+			for(auto& a : added) {
+				file(a.filter, std::move(a.handler));
+			}
+			added.clear();
+		}
+	public:
+		template<typename Projection> FilterIndex(Projection projection) : projection(std::move(projection)), locked(false) {}
+		FilterIndex(const FilterIndex&) = delete;
+		FilterIndex& operator=(const FilterIndex&) = delete;
+		Filter<Key, Rest...> equals(Key key) {
+			return Filter<Key, Rest...>{this, key, key, false};
+		}
+		Filter<Key, Rest...> between(Key lo, Key hi) {
+			return Filter<Key, Rest...>{this, lo, hi, true};
+		}
+		template<typename... Args> void dispatch(Args&&... fargs) {
+			Key key = projection(fargs...);
+			std::vector<std::exception_ptr> errors;
+			auto call = [&](HandlerPtr& handler) {
+				try {
+					handler(fargs...);
+				} catch(...) {
+					collectError(errors);
+				}
+			};
+			if(locked.load(std::memory_order_relaxed)) {
+				std::vector<Node> matched;
+				{
+					WaiterGuard guard(m);
+					match(key, [&](Node& handler) {
+						matched.push_back(handler);
+					});
+				}
+				for(auto& handler : matched) {
+					call(*handler);
+				}
+			}
+			else {
+				DispatchScope scope(*this);
+				match(key, [&](Node& handler) {
+					call(*handler);
+				});
+			}
+			if(errors.size() == 1) {
+				std::rethrow_exception(errors.front());
+			}
+			if(!errors.empty()) {
+				throw SpreadErrors(std::move(errors));
+			}
+		}
+		std::function<void(Rest...)> input() {
+			return [this](Rest... fargs) {
+				dispatch(fargs...);
+			};
+		}
+		// The handle source last attached the index under, 0 if none.
+		// Concurrent when source may trigger from several threads, which
+		// makes triggers lock before the index is attached there.
+		Handle attachment(const void* source, bool concurrent) {
+			WaiterGuard guard(m);
+			if(concurrent) {
+				locked.store(true, std::memory_order_relaxed);
+			}
+			for(auto& s : sources) {
+				if(s.emitter == source) {
+					return s.handle;
+				}
+			}
+			return 0;
+		}
+		// Records that source runs the index under handle. False when
+		// another thread did so since attachment() returned previous, the
+		// caller then removes handle again.
+		bool attach(const void* source, Handle previous, Handle handle) {
+			WaiterGuard guard(m);
+			for(auto& s : sources) {
+				if(s.emitter == source) {
+					if(s.handle != previous) {
+						return false;
+					}
+					s.handle = handle;
+					return true;
+				}
+			}
+			if(previous) {
+				return false;
+			}
+			sources.push_back(Source{source, handle});
+			return true;
+		}
+		Handle on(const Filter<Key, Rest...>& filter, Handler handler) {
+			WaiterGuard guard(m);
+			Node node = std::make_shared<HandlerPtr>(std::move(handler));
+			if(triggering) {
+				added.push_back(Added{filter, node});
+				return *node;
+			}
+			return file(filter, std::move(node));
+		}
+		bool remove(Handle handle) {
+			WaiterGuard guard(m);
+			for(auto a = added.begin();a != added.end();++a) {
+				if(*a->handler == handle) {
+					added.erase(a);
+					return true;
+				}
+			}
+			auto found = [&](Node& handler) {
+				return *handler == handle && !(handler->flags & HandlerPtr::Removed);
+			};
+			for(auto it = exact.begin();it != exact.end();++it) {
+				auto& handlers = it->second;
+				for(auto h = handlers.begin();h != handlers.end();++h) {
+					if(!found(*h)) {
+						continue;
+					}
+					if(triggering) {
+						(*h)->flags |= HandlerPtr::Removed;
+						dirty = true;
+					} else {
+						handlers.erase(h);
+						if(handlers.empty()) {
+							exact.erase(it);
+						}
+					}
+					return true;
+				}
+			}
+			for(size_t i = 0;i < ranged.size();++i) {
+				if(!found(ranged[i])) {
+					continue;
+				}
+				if(triggering) {
+					ranged[i]->flags |= HandlerPtr::Removed;
+					dirty = true;
+				} else {
+					los.erase(los.begin() + i);
+					his.erase(his.begin() + i);
+					ranged.erase(ranged.begin() + i);
+				}
+				return true;
+			}
+			return false;
+		}
+		int count() {
+			WaiterGuard guard(m);
+			size_t count = added.size();
+			auto live = [](const Node& handler) {
+				return !(handler->flags & HandlerPtr::Removed);
+			};
+			count += std::count_if(ranged.begin(), ranged.end(), live);
+			for(auto& it : exact) {
+				count += std::count_if(it.second.begin(), it.second.end(), live);
+			}
+			return static_cast<int>(count);
+		}
+	};
+
+	// Tag base for EventSet members: struct Connect : EE::Event<int> {};
+	template<typename... Args>
+	struct Event {
+		typedef std::function<void(Args...)> Handler;
+		typedef EventEmitterCore<Args...> Core;
+	};
+
+	template<typename E, typename... Events> struct EventIndex;
+	template<typename E, typename... Rest>
+	struct EventIndex<E, E, Rest...> : std::integral_constant<size_t, 0> {};
+	template<typename E, typename First, typename... Rest>
+	struct EventIndex<E, First, Rest...> : std::integral_constant<size_t, 1 + EventIndex<E, Rest...>::value> {};
+
+	// One event of an EventSet. Its handler table is embedded instead of
+	// allocated on the first subscription, so all tables of a set share
+	// the set's one allocation.
+	template<typename Core>
+	class EventSlot : public Core {
+		typename Core::Table inlineTable;
+	public:
+		EventSlot() {
+			this->table.borrow(&inlineTable);
+		}
+		EventSlot(const EventSlot&) = delete;
+		EventSlot& operator=(const EventSlot&) = delete;
+		~EventSlot() {
+			this->table.release();
+		}
+		using Core::on;
+		using Core::once;
+		using Core::connect;
+		using Core::setErrorPolicy;
+		using Core::hasHandlers;
+		using Core::countHandlers;
+		using Core::listening;
+		using Core::trigger;
+		using Core::next;
+		using Core::stream;
+		using Core::removeHandler;
+		using Core::clearHandlers;
+	};
+
+	// Several typed events on one object. The handler lists of all events
+	// live in a single block allocated on the first subscription, and
+	// deferred events of all of them share one queue.
+	template<typename... Events>
+	class EventSet : public DeferredBase {
+		typedef std::tuple<EventSlot<typename Events::Core>...> Table;
+		std::unique_ptr<Table> table;
+
+		Table& slots() {
+			if(!table) {
+				table.reset(new Table());
+			}
+			return *table;
+		}
+		template<typename E> auto& slot() {
+			return std::get<EventIndex<E, Events...>::value>(slots());
+		}
+		// handlers may call this from inside a trigger, keep the table
+		template<size_t... I> void clearSlots(std::index_sequence<I...>) {
+			using expand = int[];
+			(void)expand{0, (std::get<I>(*table).clearHandlers(), 0)...};
+		}
+	public:
+		EventSet() {}
+		template<typename E> handle_id_type on(typename E::Handler handler, Priority priority = Priority::Normal) {
+			return slot<E>().on(std::move(handler), priority);
+		}
+		template<typename E> handle_id_type once(typename E::Handler handler, Priority priority = Priority::Normal) {
+			return slot<E>().once(std::move(handler), priority);
+		}
+		template<typename E> ScopedConnection connect(typename E::Handler handler, Priority priority = Priority::Normal) {
+			return slot<E>().connect(std::move(handler), priority);
+		}
+		template<typename E> void setErrorPolicy(ErrorPolicy policy, ErrorHandler handler = nullptr) {
+			slot<E>().setErrorPolicy(policy, std::move(handler));
+		}
+		template<typename E> bool hasHandlers() {
+			return table && slot<E>().hasHandlers();
+		}
+		template<typename E> int countHandlers() {
+			return table ? slot<E>().countHandlers() : 0;
+		}
+		template<typename E, typename... Args> void trigger(Args&&... fargs) {
+			if(table) {
+				slot<E>().trigger(std::forward<Args>(fargs)...);
+			}
+		}
+		// trigger<E>() with arguments made by factory, which is only
+		// called when E has handlers or waiters
+		template<typename E, typename Factory> void emitLazy(Factory&& factory) {
+			if(table && slot<E>().listening()) {
+				LazyArgs<typename E::Handler>::apply([this](auto&&... fargs) {
+					this->template trigger<E>(std::forward<decltype(fargs)>(fargs)...);
+				}, factory);
+			}
+		}
+		template<typename E, typename... Args> void defer(Args... fargs) {
+			deferWithPriority<E>(Priority::Normal, fargs...);
+		}
+		template<typename E, typename... Args> void deferWithPriority(Priority priority, Args... fargs) {
+			runDeferred(
+				std::bind([this](Args... as) {
+				this->template trigger<E>(as...);
+				}, fargs...), priority);
+		}
+		template<typename E> typename E::Core::Awaiter next(DeferredBase* executor = nullptr) {
+			return slot<E>().next(executor);
+		}
+		template<typename E> typename E::Core::Stream stream(DeferredBase* executor = nullptr, size_t capacity = defaultStreamCapacity) {
+			return slot<E>().stream(executor, capacity);
+		}
+		template<typename E> bool removeHandler(handle_id_type handle) {
+			return table && slot<E>().removeHandler(handle);
+		}
+		template<typename E> void removeAllHandlers() {
+			if(table) {
+				slot<E>().clearHandlers();
+			}
+		}
+		void removeAllHandlers() {
+			if(table) {
+				clearSlots(std::index_sequence_for<Events...>());
+			}
+			DeferredBase::removeAllHandlers();
+		}
+	};
+
+	// Reducers for CollectingEventEmitter::emitCollect. operator() folds one
+	// handler result into the accumulator and returns false to stop asking
+	// further handlers; combine() folds the accumulator of a later group of
+	// handlers, for emitCollectParallel.
+	struct FirstValue {
+		template<typename Acc, typename V> bool operator()(Acc& acc, V&& value) const {
+			if(!value) {
+				return true;
+			}
+			acc = std::forward<V>(value);
+			return false;
+		}
+		template<typename Acc> bool combine(Acc& acc, Acc&& part) const {
+			return (*this)(acc, std::move(part));
+		}
+	};
+	struct AnyOf {
+		template<typename V> bool operator()(bool& acc, V&& value) const {
+			acc = acc || static_cast<bool>(value);
+			return !acc;
+		}
+		bool combine(bool& acc, bool part) const {
+			return (*this)(acc, part);
+		}
+	};
+	struct AllOf {
+		template<typename V> bool operator()(bool& acc, V&& value) const {
+			acc = acc && static_cast<bool>(value);
+			return acc;
+		}
+		bool combine(bool& acc, bool part) const {
+			return (*this)(acc, part);
+		}
+	};
+	struct CollectAll {
+		template<typename Acc, typename V> bool operator()(Acc& acc, V&& value) const {
+			acc.push_back(std::forward<V>(value));
+			return true;
+		}
+		template<typename Acc> bool combine(Acc& acc, Acc&& part) const {
+			for(auto& value : part) {
+				acc.push_back(std::move(value));
+			}
+			return true;
+		}
+	};
+
+	// Emitter whose handlers answer: emitCollect() asks them in order and
+	// folds the results with a reducer, which may stop early.
+	template<typename Signature> class CollectingEventEmitter;
+	template<typename R, typename... Rest>
+	class CollectingEventEmitter<R(Rest...)> : public HandlerList<R, Rest...> {
+		static_assert(!std::is_void<R>::value, "use EventEmitter for handlers without results");
+		typedef HandlerList<R, Rest...> Base;
+		typedef typename Base::HandlerPtr HandlerPtr;
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::Handle Handle;
+
+		Handle on(Handler handler, Priority priority = Priority::Normal) {
+			return Base::on(std::move(handler), priority);
+		}
+		Handle once(Handler handler, Priority priority = Priority::Normal) {
+			return Base::once(std::move(handler), priority);
+		}
+		ScopedConnection connect(Handler handler, Priority priority = Priority::Normal) {
+			return Base::connect(std::move(handler), priority);
+		}
+		void setErrorPolicy(ErrorPolicy policy, ErrorHandler handler = nullptr) {
+			Base::setErrorPolicy(policy, std::move(handler));
+		}
+		using Base::hasHandlers;
+		using Base::countHandlers;
+		using Base::removeHandler;
+		void removeAllHandlers() {
+			Base::clearHandlers();
+		}
+		template<typename Reducer, typename Acc, typename... Args> Acc emitCollect(Reducer reducer, Acc init, Args&&... fargs) {
+			Acc acc = std::move(init);
+			if(!this->table) {
+				return acc;
+			}
+			std::vector<std::exception_ptr> errors;
+			this->visit(errors, [&](HandlerPtr& handler) {
+				return reducer(acc, handler(fargs...));
+			});
+			if(!errors.empty()) {
+				this->raise(errors);
+			}
+			return acc;
+		}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		// Splits the handlers into contiguous groups run on the threads of
+		// ThreadPool::shared() and the caller, each reducing into its own
+		// copy of init (so init must be neutral for combine), and combines
+		// the groups in order on the caller. A group that stops early
+		// cancels the later ones only, giving the same result as
+		// emitCollect for order-dependent reducers. Once handlers are used
+		// up only if they were called.
+		template<typename Reducer, typename Acc, typename... Args> Acc emitCollectParallel(Reducer reducer, Acc init, Args&&... fargs) {
+			if(!this->table) {
+				return init;
+			}
+			auto& t = *this->table;
+			std::vector<std::exception_ptr> errors;
+			Acc acc = init;
+			{
+				// nested triggers only tombstone, the workers can keep
+				// pointers to the nodes until the scope ends
+				typename Base::TriggerScope scope(t);
+				auto useUp = [&](HandlerPtr& handler) {
+					handler.flags |= HandlerPtr::Removed;
+					t.live.fetch_sub(1, std::memory_order_relaxed);
+					t.dirty = true;
+				};
+				std::vector<HandlerPtr*> handlers;
+				for(auto& handler : t.eventHandlers) {
+					if(handler.flags & (HandlerPtr::Removed | HandlerPtr::Pending)) {
+						continue;
+					}
+					if(handler.expired()) {
+						useUp(handler);
+						continue;
+					}
+					handlers.push_back(&handler);
+				}
+				size_t groups = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), handlers.size());
+				if(groups) {
+					size_t size = (handlers.size() + groups - 1) / groups;
+					groups = (handlers.size() + size - 1) / size;
+					struct Part {
+						Acc acc;
+						std::vector<std::exception_ptr> errors;
+						// end of the handlers called, once handlers up to
+						// here are used up
+						size_t called;
+					};
+					std::vector<Part> parts;
+					parts.reserve(groups);
+					for(size_t g = 0;g < groups;++g) {
+						parts.push_back(Part{init, {}, g * size});
+					}
+					std::atomic<size_t> stoppedAt(groups);
+					auto runGroup = [&](size_t g) {
+						size_t end = std::min(handlers.size(), (g + 1) * size);
+						for(size_t h = g * size;h < end && stoppedAt.load(std::memory_order_relaxed) > g;++h) {
+							bool more = true;
+							parts[g].called = h + 1;
+							try {
+								more = reducer(parts[g].acc, (*handlers[h])(fargs...));
+							} catch(...) {
+								collectError(parts[g].errors);
+							}
+							if(!more) {
+								size_t current = stoppedAt.load();
+								while(current > g && !stoppedAt.compare_exchange_weak(current, g));
+								break;
+							}
+						}
+					};
+					// Groups are claimed by the caller and the pool tasks
+					// alike, so the call completes even when every pool
+					// thread is busy, e.g. running this very emitter. A task
+					// starting after the call returned finds nothing to claim
+					// and only touches the shared block.
+					struct Join {
+						std::atomic<size_t> next;
+						size_t groups, finished = 0;
+						std::function<void(size_t)> run;
+						std::mutex m;
+						std::condition_variable done;
+						Join() : next(0) {}
+						void claim() {
+							for(size_t g;(g = next.fetch_add(1)) < groups;) {
+								run(g);
+								std::lock_guard<std::mutex> guard(m);
+								if(++finished == groups) {
+									done.notify_all();
+								}
+							}
+						}
+					};
+					auto join = std::make_shared<Join>();
+					join->groups = groups;
+					join->run = runGroup;
+					for(size_t g = 1;g < groups;++g) {
+						ThreadPool::shared().execute([join] {
+							join->claim();
+						});
+					}
+					join->claim();
+					{
+						std::unique_lock<std::mutex> lk(join->m);
+						join->done.wait(lk, [&] {
+							return join->finished == groups;
+						});
+					}
+					for(size_t g = 0;g < groups;++g) {
+						for(size_t h = g * size;h < parts[g].called;++h) {
+							if(handlers[h]->specialFlag()) {
+								useUp(*handlers[h]);
+							}
+						}
+					}
+					for(auto& part : parts) {
+						errors.insert(errors.end(), part.errors.begin(), part.errors.end());
+						if(!reducer.combine(acc, std::move(part.acc))) {
+							break;
+						}
+					}
+				}
+			}
+			if(t.dirty && !t.triggering) {
+				this->compact();
+			}
+			if(!errors.empty()) {
+				this->raise(errors);
+			}
+			return acc;
+		}
+#endif
+	};
+
+	// Timers of the rate operators, kept in one intrusive binary heap so
+	// that scheduling never allocates once the heap has grown. advance()
+	// fires due timers on the calling thread; shared() runs one service on
+	// a background thread (without threading it has to be advanced by hand).
+	class TimerService {
+	public:
+		typedef std::chrono::steady_clock Clock;
+		class Timer {
+			friend class TimerService;
+			Clock::time_point due;
+			size_t slot = npos;
+		public:
+			std::function<void(Clock::time_point)> fire;
+		};
+	private:
+		static const size_t npos = static_cast<size_t>(-1);
+		std::vector<Timer*> heap;
+		WaiterLock m;
+		Timer* running = nullptr;
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		std::condition_variable changed;
+		std::thread::id runningThread;
+		bool stopping = false;
+		std::thread thread;
+#endif
+
+		void place(size_t i, Timer* timer) {
+			heap[i] = timer;
+			timer->slot = i;
+		}
+		void up(size_t i) {
+			Timer* timer = heap[i];
+			while(i > 0 && timer->due < heap[(i - 1) / 2]->due) {
+				place(i, heap[(i - 1) / 2]);
+				i = (i - 1) / 2;
+			}
+			place(i, timer);
+		}
+		void down(size_t i) {
+			Timer* timer = heap[i];
+			while(2 * i + 1 < heap.size()) {
+				size_t child = 2 * i + 1;
+				if(child + 1 < heap.size() && heap[child + 1]->due < heap[child]->due) {
+					child++;
+				}
+				if(!(heap[child]->due < timer->due)) {
+					break;
+				}
+				place(i, heap[child]);
+				i = child;
+			}
+			place(i, timer);
+		}
+		void unlink(Timer& timer) {
+			size_t i = timer.slot;
+			timer.slot = npos;
+			Timer* last = heap.back();
+			heap.pop_back();
+			if(last != &timer) {
+				place(i, last);
+				up(i);
+				down(last->slot);
+			}
+		}
+	public:
+		TimerService() {}
+		TimerService(const TimerService&) = delete;
+		TimerService& operator=(const TimerService&) = delete;
+		~TimerService() {
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			if(thread.joinable()) {
+				{
+					std::lock_guard<std::mutex> guard(m);
+					stopping = true;
+				}
+				changed.notify_all();
+				thread.join();
+			}
+#endif
+		}
+		static TimerService& shared() {
+			static TimerService service;
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			static std::once_flag started;
+			std::call_once(started, [] {
+				service.thread = std::thread([] {
+					service.run();
+				});
+			});
+#endif
+			return service;
+		}
+		// (re)schedules timer to fire at due
+		void schedule(Timer& timer, Clock::time_point due) {
+			{
+				WaiterGuard guard(m);
+				if(timer.slot != npos) {
+					unlink(timer);
+				}
+				timer.due = due;
+				heap.push_back(&timer);
+				place(heap.size() - 1, &timer);
+				up(timer.slot);
+			}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			changed.notify_all();
+#endif
+		}
+		// unschedules timer, waiting for it to finish if it is firing on
+		// another thread
+		void cancel(Timer& timer) {
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			std::unique_lock<std::mutex> lk(m);
+			changed.wait(lk, [&] {
+				return running != &timer || runningThread == std::this_thread::get_id();
+			});
+#else
+			WaiterGuard guard(m);
+#endif
+			if(timer.slot != npos) {
+				unlink(timer);
+			}
+		}
+		// fires every timer due by now, returns how many fired
+		size_t advance(Clock::time_point now = Clock::now()) {
+			size_t count = 0;
+			while(true) {
+				Timer* timer;
+				{
+					WaiterGuard guard(m);
+					if(heap.empty() || now < heap[0]->due) {
+						break;
+					}
+					timer = heap[0];
+					unlink(*timer);
+					running = timer;
+#ifndef EVENTEMITTER_DISABLE_THREADING
+					runningThread = std::this_thread::get_id();
+#endif
+				}
+				try {
+					timer->fire(now);
+				} catch(...) {
+				}
+				{
+					WaiterGuard guard(m);
+					running = nullptr;
+				}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+				changed.notify_all();
+#endif
+				count++;
+			}
+			return count;
+		}
+	private:
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		void run() {
+			std::unique_lock<std::mutex> lk(m);
+			while(!stopping) {
+				if(heap.empty()) {
+					changed.wait(lk);
+				}
+				else if(Clock::now() < heap[0]->due) {
+					Clock::time_point due = heap[0]->due;
+					changed.wait_until(lk, due);
+				}
+				else {
+					lk.unlock();
+					advance();
+					lk.lock();
+				}
+			}
+		}
+#endif
+	};
+
+	// Handler side shared by the rate operators, which are emitters of
+	// their own fed through input(). They trigger from the timer thread
+	// while handlers come and go on others, so the handlers are locked.
+	template<typename... Out>
+	class OperatorOutput : public LockedEventEmitterCore<MutexLock, Out...> {
+		typedef LockedEventEmitterCore<MutexLock, Out...> Base;
+	public:
+		typedef typename Base::Handler Handler;
+		typedef typename Base::Handle Handle;
+		Handle on(Handler handler, Priority priority = Priority::Normal) {
+			return Base::on(std::move(handler), priority);
+		}
+		Handle once(Handler handler, Priority priority = Priority::Normal) {
+			return Base::once(std::move(handler), priority);
+		}
+		ScopedConnection connect(Handler handler, Priority priority = Priority::Normal) {
+			return Base::connect(std::move(handler), priority);
+		}
+		using Base::hasHandlers;
+		using Base::countHandlers;
+		using Base::removeHandler;
+		using Base::setErrorPolicy;
+	};
+
+	// Keeps the latest event and hands it on from the timer. Events are
+	// stored by assignment into a preallocated tuple and moved out of it
+	// under the lock to be emitted, so a push or tick emitting at the same
+	// time never shares the outgoing event.
+	template<typename... Rest>
+	class LatestValueOperator : public OperatorOutput<Rest...> {
+	protected:
+		typedef TimerService::Clock Clock;
+		typedef std::tuple<typename std::decay<Rest>::type...> Args;
+		TimerService& timers;
+		TimerService::Timer timer;
+		Clock::duration interval;
+		WaiterLock m;
+		Args latest;
+		bool pending = false;
+		bool armed = false;
+
+		LatestValueOperator(Clock::duration interval, TimerService& timers) : timers(timers), interval(interval) {}
+		// timer.fire calls the derived tick(), so the derived classes
+		// cancel the timer in their own destructors
+		void start() {
+			timer.fire = [this](Clock::time_point now) {
+				tick(now);
+			};
+		}
+		void stop() {
+			timers.cancel(timer);
+		}
+		virtual void tick(Clock::time_point now) = 0;
+		void arm(Clock::time_point due) {
+			armed = true;
+			timers.schedule(timer, due);
+		}
+		// called with m held, releases it before running the handlers
+		void emitLatest() {
+			pending = false;
+			Args outgoing(std::move(latest));
+			m.unlock();
+			emit(outgoing, std::index_sequence_for<Rest...>());
+		}
+		template<size_t... I> void emit(Args& outgoing, std::index_sequence<I...>) {
+			this->trigger(std::get<I>(outgoing)...);
+		}
+	public:
+		LatestValueOperator(const LatestValueOperator&) = delete;
+		LatestValueOperator& operator=(const LatestValueOperator&) = delete;
+		std::function<void(Rest...)> input() {
+			return [this](Rest... fargs) {
+				push(fargs...);
+			};
+		}
+		virtual void push(Rest... fargs) = 0;
+	};
+
+	// Passes the first event of each interval at once and the last one
+	// dropped during it when the interval ends.
+	template<typename... Rest>
+	class Throttle : public LatestValueOperator<Rest...> {
+		typedef LatestValueOperator<Rest...> Base;
+		typename Base::Clock::time_point nextAllowed;
+	public:
+		Throttle(typename Base::Clock::duration interval, TimerService& timers = TimerService::shared()) : Base(interval, timers) {
+			this->start();
+		}
+		~Throttle() {
+			this->stop();
+		}
+		void push(Rest... fargs) override {
+			auto now = Base::Clock::now();
+			this->m.lock();
+			if(now >= nextAllowed && !this->armed) {
+				nextAllowed = now + this->interval;
+				this->latest = std::make_tuple(fargs...);
+				this->emitLatest();
+				return;
+			}
+			this->latest = std::make_tuple(fargs...);
+			this->pending = true;
+			if(!this->armed) {
+				this->arm(nextAllowed);
+			}
+			this->m.unlock();
+		}
+	protected:
+		void tick(typename Base::Clock::time_point now) override {
+			this->m.lock();
+			this->armed = false;
+			if(!this->pending) {
+				this->m.unlock();
+				return;
+			}
+			nextAllowed = now + this->interval;
+			this->emitLatest();
+		}
+	};
+
+	// Passes the last event once no event arrived for interval.
+	template<typename... Rest>
+	class Debounce : public LatestValueOperator<Rest...> {
+		typedef LatestValueOperator<Rest...> Base;
+		typename Base::Clock::time_point last;
+	public:
+		Debounce(typename Base::Clock::duration interval, TimerService& timers = TimerService::shared()) : Base(interval, timers) {
+			this->start();
+		}
+		~Debounce() {
+			this->stop();
+		}
+		void push(Rest... fargs) override {
+			auto now = Base::Clock::now();
+			WaiterGuard guard(this->m);
+			this->latest = std::make_tuple(fargs...);
+			this->pending = true;
+			last = now;
+			// not moved per event, tick() pushes it back while events keep coming
+			if(!this->armed) {
+				this->arm(now + this->interval);
+			}
+		}
+	protected:
+		void tick(typename Base::Clock::time_point now) override {
+			this->m.lock();
+			this->armed = false;
+			if(now < last + this->interval) {
+				this->arm(last + this->interval);
+			}
+			if(this->armed || !this->pending) {
+				this->m.unlock();
+				return;
+			}
+			this->emitLatest();
+		}
+	};
 
-#if defined(__GNUC__)
-#define __EVENTEMITTER_GCC_WORKAROUND this->
-#else
-#define __EVENTEMITTER_GCC_WORKAROUND
-#endif
+	// Passes the latest event, if there was a new one, every interval.
+	template<typename... Rest>
+	class Sample : public LatestValueOperator<Rest...> {
+		typedef LatestValueOperator<Rest...> Base;
+		typename Base::Clock::time_point origin = Base::Clock::now();
+	public:
+		Sample(typename Base::Clock::duration interval, TimerService& timers = TimerService::shared()) : Base(interval, timers) {
+			this->start();
+		}
+		~Sample() {
+			this->stop();
+		}
+		void push(Rest... fargs) override {
+			auto now = Base::Clock::now();
+			WaiterGuard guard(this->m);
+			this->latest = std::make_tuple(fargs...);
+			this->pending = true;
+			if(!this->armed) {
+				// ticks stay on the grid of multiples of interval
+				this->arm(origin + ((now - origin) / this->interval + 1) * this->interval);
+			}
+		}
+	protected:
+		void tick(typename Base::Clock::time_point) override {
+			this->m.lock();
+			this->armed = false;
+			if(!this->pending) {
+				this->m.unlock();
+				return;
+			}
+			this->emitLatest();
+		}
+	};
 
-#define __EVENTEMITTER_CONCAT_IMPL(x, y) x ## y
-#define __EVENTEMITTER_CONCAT(x, y) __EVENTEMITTER_CONCAT_IMPL(x, y)
+	// Collects events and passes them as one batch at most interval after
+	// the first one. The two buffers are swapped and keep their capacity.
+	template<typename... Rest>
+	class BufferTime : public OperatorOutput<const std::vector<std::tuple<typename std::decay<Rest>::type...>>&> {
+		typedef TimerService::Clock Clock;
+		typedef std::vector<std::tuple<typename std::decay<Rest>::type...>> Batch;
+		TimerService& timers;
+		TimerService::Timer timer;
+		Clock::duration interval;
+		WaiterLock m;
+		// held while outgoing is emitted, ticks fired on two threads
+		// at once take turns
+		WaiterLock emitting;
+		Batch buffer, outgoing;
+		bool armed = false;
 
-#ifndef __EVENTEMITTER_NONMACRO_DEFS
-#define __EVENTEMITTER_NONMACRO_DEFS
-namespace EE {
-	class DeferredBase {
-	protected: 
-		typedef std::function<void ()> DeferredHandler;
-		std::forward_list<DeferredHandler> removeHandlers;
-		std::forward_list<DeferredHandler> deferredQueue;
-		__EVENTEMITTER_MUTEX_DECLARE(mutex);
-	protected:
-		void runDeferred(DeferredHandler f) {
-			__EVENTEMITTER_LOCK_GUARD(mutex);
-			auto it = deferredQueue.cbegin();
-			auto prevIt = deferredQueue.cbefore_begin();
-			for(; it != deferredQueue.cend(); prevIt = it, ++it);
-			deferredQueue.emplace_after(prevIt, std::move(f));
+		void tick() {
+			WaiterGuard turn(emitting);
+			{
+				WaiterGuard guard(m);
+				armed = false;
+				std::swap(buffer, outgoing);
+			}
+			if(!outgoing.empty()) {
+				this->trigger(outgoing);
+			}
+			outgoing.clear();
 		}
 	public:
-		void removeAllHandlers() {
-			for(auto& handler : removeHandlers) {
-				handler();
+		BufferTime(Clock::duration interval, TimerService& timers = TimerService::shared()) : timers(timers), interval(interval) {
+			timer.fire = [this](Clock::time_point) {
+				tick();
+			};
+		}
+		BufferTime(const BufferTime&) = delete;
+		BufferTime& operator=(const BufferTime&) = delete;
+		~BufferTime() {
+			timers.cancel(timer);
+		}
+		std::function<void(Rest...)> input() {
+			return [this](Rest... fargs) {
+				push(fargs...);
+			};
+		}
+		void push(Rest... fargs) {
+			WaiterGuard guard(m);
+			buffer.emplace_back(fargs...);
+			if(!armed) {
+				armed = true;
+				timers.schedule(timer, Clock::now() + interval);
 			}
 		}
-		void clearDeferred() {
-			__EVENTEMITTER_LOCK_GUARD(mutex);
-			deferredQueue.clear();
+	};
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	// Bounded single producer, single consumer ring. Slots are constructed
+	// once and assigned in place; the consumer reads them where they are.
+	// Each side caches the other's index and only rereads it when the ring
+	// looks full or empty.
+	template<typename T>
+	class SpscRing {
+		std::vector<T> slots;
+		size_t mask;
+		char padConsumer[64];
+		std::atomic<size_t> head;
+		size_t cachedTail = 0;
+		char padProducer[64];
+		std::atomic<size_t> tail;
+		size_t cachedHead = 0;
+		char padEnd[64];
+
+		static size_t roundUp(size_t capacity) {
+			size_t size = 1;
+			while(size < capacity) {
+				size <<= 1;
+			}
+			return size;
 		}
-		bool runDeferred() {
-			__EVENTEMITTER_LOCK_GUARD(mutex);
-			if(deferredQueue.empty()) {
-				return false;
+	public:
+		explicit SpscRing(size_t capacity) : slots(roundUp(capacity)), mask(slots.size() - 1), head(0), tail(0) {}
+		SpscRing(const SpscRing&) = delete;
+		SpscRing& operator=(const SpscRing&) = delete;
+		size_t capacity() const {
+			return slots.size();
+		}
+		// approximate when called from neither side
+		size_t size() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		}
+		bool empty() const {
+			return size() == 0;
+		}
+		// producer side
+		template<typename... Args> bool tryPush(Args&&... fargs) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if(t - cachedHead == slots.size()) {
+				cachedHead = head.load(std::memory_order_acquire);
+				if(t - cachedHead == slots.size()) {
+					return false;
+				}
 			}
-			(deferredQueue.front())();
-			deferredQueue.pop_front();
+			slots[t & mask] = std::forward_as_tuple(fargs...);
+			tail.store(t + 1, std::memory_order_release);
 			return true;
 		}
-		void runAllDeferred() {
-			// TODO: make optimized runAll
-			while(runDeferred());
+		// consumer side, calls f with the oldest slot before freeing it
+		template<typename F> bool consume(F&& f) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if(h == cachedTail) {
+				cachedTail = tail.load(std::memory_order_acquire);
+				if(h == cachedTail) {
+					return false;
+				}
+			}
+			f(slots[h & mask]);
+			head.store(h + 1, std::memory_order_release);
+			return true;
 		}
 	};
-	
-	// reference_wrapper needs to be used instead of std::reference_wrapper
-	// this is because of VS2013 (RC) bug
-	template<class T> class reference_wrapper
-	{
-	public:
-		typedef T type;
-		explicit reference_wrapper(T& t): t_(&t) {}
-		operator T& () const { return *t_; }
-		T& get() const { return *t_; }
-		T* get_pointer() const { return t_; }
-private:
-    T* t_;
-};
-	
-
-// source: stackoverflow.com/questions/15501301/binding-function-arguments-in-c11
-template<typename T> struct forward_as_ref_type {
- typedef T &&type;
-};
-template<typename T> struct forward_as_ref_type<T &> {
-	typedef reference_wrapper<T> type;
-};
-template<typename T> typename forward_as_ref_type<T>::type forward_as_ref(
- typename std::remove_reference<T>::type &t) {
-    return static_cast<typename forward_as_ref_type<T>::type>(t);
- }
- template<typename T> T &&forward_as_ref(
- typename std::remove_reference<T>::type &&t) {
-    return t;
- }
 
-template<typename... Args>	
-inline decltype(auto) wrapLambdaWithCallback(const std::function<void(Args...)>& f, std::function<void()>&& afterCb) {
-	return [=,afterCb=std::move(afterCb)](Args&&... args) {
-		f(args...);
-		afterCb();
+	// How an idle pipeline stage waits: spinning on its ring for the lowest
+	// latency, or sleeping until the producer wakes it.
+	enum class WaitStrategy : uint8_t {
+		BusyPoll,
+		Park
 	};
-}
 
-template<typename... Args>	
-inline decltype(auto) wrapLambdaWithCallback(std::function<void(Args...)>&& f, std::function<void()>&& afterCb) {
-	return [f=std::move(f),afterCb=std::move(afterCb)](Args&&... args) {
-		f(args...);
-		afterCb();
+	struct StageMetrics {
+		uint64_t processed;
+		// pushes that found the ring full and had to wait
+		uint64_t stalls;
+		size_t occupancy;
+		size_t capacity;
 	};
-}
 
-#ifndef EVENTEMITTER_DISABLE_THREADING
-	
-	// TODO: allow callback for setting if async has completed
-	template<typename... Args>
-	class LambdaAsyncWrapper
-	{
-		std::function<void(Args...)> m_f;		
+	class PipelineStageBase {
+		friend class Pipeline;
+	protected:
+		WaitStrategy waitStrategy;
+		int cpu;
+		std::atomic<bool> stopping;
+		std::atomic<bool> parked;
+		std::atomic<uint64_t> processed;
+		std::atomic<uint64_t> stalls;
+		std::mutex m;
+		std::condition_variable wake;
+		std::thread thread;
+
+		PipelineStageBase(WaitStrategy waitStrategy, int cpu) : waitStrategy(waitStrategy), cpu(cpu), stopping(false), parked(false), processed(0), stalls(0) {}
+		virtual bool runOne() = 0;
+		virtual bool pending() const = 0;
+		virtual size_t occupancy() const = 0;
+		virtual size_t capacity() const = 0;
+		// producer side, after a push
+		void notify() {
+			if(waitStrategy == WaitStrategy::Park && parked.load()) {
+				std::lock_guard<std::mutex> guard(m);
+				wake.notify_one();
+			}
+		}
+		void run() {
+			int idle = 0;
+			while(true) {
+				if(runOne()) {
+					idle = 0;
+					continue;
+				}
+				if(stopping.load(std::memory_order_acquire) && !pending()) {
+					break;
+				}
+				if(waitStrategy == WaitStrategy::BusyPoll || ++idle < 100) {
+					continue;
+				}
+				std::unique_lock<std::mutex> lk(m);
+				parked.store(true);
+				// timed, stop() does not go through notify()
+				wake.wait_for(lk, std::chrono::milliseconds(1), [this] {
+					return pending() || stopping.load();
+				});
+				parked.store(false);
+			}
+		}
+		void start() {
+			thread = std::thread([this] {
+				run();
+			});
+#ifdef __EVENTEMITTER_HAS_AFFINITY
+			if(cpu >= 0) {
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+			}
+#endif
+		}
+		void stop() {
+			if(thread.joinable()) {
+				stopping.store(true, std::memory_order_release);
+				thread.join();
+			}
+		}
 	public:
-		LambdaAsyncWrapper(const std::function<void(Args...)>& f) : m_f(f) {}
-		void operator()(Args... fargs) const { 
-			std::async(std::launch::async, m_f, fargs...);
+		virtual ~PipelineStageBase() {}
+		StageMetrics metrics() const {
+			return StageMetrics{processed.load(std::memory_order_relaxed), stalls.load(std::memory_order_relaxed), occupancy(), capacity()};
 		}
 	};
-	template<typename... Args>
-	LambdaAsyncWrapper<Args...> wrapLambdaInAsync(const std::function<void(Args...)>& f) {
-		return LambdaAsyncWrapper<Args...>(f);
-	};
-	
-	template<typename... Args>
-	class LambdaPromiseWrapper
-	{
-		std::shared_ptr<std::promise<std::tuple<Args...>>> m_promise;
+
+	// One stage: events pushed by a single upstream thread are queued in
+	// an SpscRing and run through the stage's handlers on its own thread.
+	// Subscribe before Pipeline::start().
+	template<typename... Rest>
+	class PipelineStage : public PipelineStageBase, public OperatorOutput<Rest...> {
+		friend class Pipeline;
+		typedef std::tuple<typename std::decay<Rest>::type...> Args;
+		SpscRing<Args> ring;
+
+		template<size_t... I> void apply(Args& args, std::index_sequence<I...>) {
+			this->trigger(std::get<I>(args)...);
+		}
+		bool runOne() override {
+			bool ran = ring.consume([this](Args& args) {
+				// nowhere to propagate to, use setErrorPolicy to see them
+				try {
+					apply(args, std::index_sequence_for<Rest...>());
+				} catch(...) {
+				}
+			});
+			if(ran) {
+				processed.store(processed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			}
+			return ran;
+		}
+		bool pending() const override {
+			return !ring.empty();
+		}
+		size_t occupancy() const override {
+			return ring.size();
+		}
+		size_t capacity() const override {
+			return ring.capacity();
+		}
 	public:
-		LambdaPromiseWrapper(std::shared_ptr<std::promise<std::tuple<Args...>>> promise) : m_promise(promise) {}
-		void operator()(Args... fargs) const { 
-			m_promise->set_value(std::tuple<Args...>(fargs...));
+		PipelineStage(size_t capacity, WaitStrategy waitStrategy, int cpu) : PipelineStageBase(waitStrategy, cpu), ring(capacity) {}
+		// from the single upstream thread, waits while the ring is full
+		template<typename... Args> void push(Args&&... fargs) {
+			if(!ring.tryPush(fargs...)) {
+				stalls.fetch_add(1, std::memory_order_relaxed);
+				while(!ring.tryPush(fargs...)) {
+					std::this_thread::yield();
+				}
+			}
+			notify();
+		}
+		std::function<void(Rest...)> input() {
+			return [this](Rest... fargs) {
+				push(fargs...);
+			};
 		}
-	};
-	template<typename... Args>
-	LambdaPromiseWrapper<Args...> getLambdaForFuture(std::shared_ptr<std::promise<std::tuple<Args...>>> promise) {
-		return LambdaPromiseWrapper<Args...>(promise);
 	};
 
+	// Chain of stages each on its own thread, such as parse -> enrich ->
+	// publish: stage.on(next.input()) hands events on. stop() stops the
+	// stages in the order they were added, each after draining its ring,
+	// so wire them front to back.
+	class Pipeline {
+		std::vector<std::unique_ptr<PipelineStageBase>> stages;
+		bool running = false;
+	public:
+		Pipeline() {}
+		Pipeline(const Pipeline&) = delete;
+		Pipeline& operator=(const Pipeline&) = delete;
+		~Pipeline() {
+			stop();
+		}
+		// cpu >= 0 pins the stage thread where supported
+		template<typename... Rest> PipelineStage<Rest...>& stage(size_t capacity = 1024, WaitStrategy waitStrategy = WaitStrategy::Park, int cpu = -1) {
+			auto stage = new PipelineStage<Rest...>(capacity, waitStrategy, cpu);
+			stages.emplace_back(stage);
+			return *stage;
+		}
+		void start() {
+			if(running) {
+				return;
+			}
+			running = true;
+			for(auto& stage : stages) {
+				stage->stopping.store(false);
+				stage->start();
+			}
+		}
+		void stop() {
+			if(!running) {
+				return;
+			}
+			for(auto& stage : stages) {
+				stage->stop();
+			}
+			running = false;
+		}
+		std::vector<StageMetrics> metrics() const {
+			std::vector<StageMetrics> result;
+			for(auto& stage : stages) {
+				result.push_back(stage->metrics());
+			}
+			return result;
+		}
+	};
 #endif // EVENTEMITTER_DISABLE_THREADING
 	
 }
 #endif // __EVENTEMITTER_NONMACRO_DEFS
 
 
-#ifndef __EVENTEMITTER_CONTAINER
-#define __EVENTEMITTER_CONTAINER std::forward_list<HandlerPtr>
-#endif
-
-using handle_id_type = uint32_t;
-static handle_id_type __handle_counter;
-
 #define __EVENTEMITTER_PROVIDER(frontname, name)  \
-template<typename... Rest> \
-class __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl) { \
+template<typename Core> \
+class __EVENTEMITTER_CONCAT(frontname,EventEmitterNames) : public Core { \
 public: \
-	typedef std::function<void(Rest...)> Handler; \
-	using Handle = handle_id_type; \
-	using HandlerTuple = std::tuple<Handle, Handler>; \
-	struct HandlerPtr : public HandlerTuple { \
-		HandlerPtr(Handler handler, bool _specialFlag = false) : HandlerTuple((__handle_counter++) | _specialFlag << 31 , std::move(handler)) { \
-			if(__handle_counter & 0x80000000) { \
-				__handle_counter = 0; \
+	using Core::Core; \
+	typedef typename Core::Handler Handler; \
+	typedef typename Core::Handle Handle; \
+	typedef typename Core::HandlerPtr HandlerPtr; \
+ \
+	Handle __EVENTEMITTER_CONCAT(on,name) (Handler handler, EE::Priority priority = EE::Priority::Normal) { \
+		return Core::on(std::move(handler), priority); \
+	} \
+	Handle __EVENTEMITTER_CONCAT(once,name) (Handler handler, EE::Priority priority = EE::Priority::Normal) { \
+		return Core::once(std::move(handler), priority); \
+	} \
+	template<typename Obj, typename Method> Handle __EVENTEMITTER_CONCAT(on,name) (const std::weak_ptr<Obj>& owner, Method method, EE::Priority priority = EE::Priority::Normal) { \
+		Obj* object = owner.lock().get(); \
+		return Core::onOwned(owner, [object, method](auto&&... fargs) { \
+			(object->*method)(fargs...); \
+		}, priority); \
+	} \
+	Handle __EVENTEMITTER_CONCAT(on,name) (EE::ExecutorRef executor, Handler handler, EE::Priority priority = EE::Priority::Normal) { \
+		return Core::onBound(executor, std::move(handler), priority); \
+	} \
+	template<typename Key, typename... Args> Handle __EVENTEMITTER_CONCAT(on,name) (const EE::Filter<Key, Args...>& filter, Handler handler) { \
+		auto index = filter.index; \
+		Handle previous = index->attachment(this, Core::concurrent); \
+		if(!previous || !Core::hasHandler(previous)) { \
+			Handle input = Core::on(index->input(), EE::Priority::Normal); \
+			if(!index->attach(this, previous, input)) { \
+				Core::removeHandler(input); \
 			} \
 		} \
-		bool specialFlag() { \
-			return std::get<0>(*this) & 0x80000000; \
-		} \
-		bool operator==(Handle other) { \
-			return std::get<0>(*this) == other; \
-		} \
-		template<typename... Args> inline decltype(auto) operator() (Args&&... fargs) { \
-			return std::get<1>(*this)(fargs...); \
-		} \
-		operator Handle() const { return std::get<0>(*this); } \
-	}; \
- \
-private: \
-	using EventHandlersSet = __EVENTEMITTER_CONTAINER; \
-	EventHandlersSet eventHandlers; \
-public: \
-	Handle __EVENTEMITTER_CONCAT(on,name) (Handler handler) { \
-		eventHandlers.emplace_front(std::move(handler)); \
-		return eventHandlers.front(); \
+		return index->on(filter, std::move(handler)); \
 	} \
-	Handle __EVENTEMITTER_CONCAT(once,name) (Handler handler) { \
-		eventHandlers.emplace_front(std::move(handler), true); \
-		return eventHandlers.front(); \
+	EE::ScopedConnection __EVENTEMITTER_CONCAT(connect,name) (Handler handler, EE::Priority priority = EE::Priority::Normal) { \
+		return Core::connect(std::move(handler), priority); \
+	} \
+	void __EVENTEMITTER_CONCAT(set,__EVENTEMITTER_CONCAT(name, ErrorPolicy)) (EE::ErrorPolicy policy, EE::ErrorHandler handler = nullptr) { \
+		Core::setErrorPolicy(policy, std::move(handler)); \
 	} \
 	bool __EVENTEMITTER_CONCAT(has,__EVENTEMITTER_CONCAT(name, Handlers))() { \
-		return !eventHandlers.empty(); \
+		return Core::hasHandlers(); \
 	} \
 	int __EVENTEMITTER_CONCAT(count,__EVENTEMITTER_CONCAT(name, Handlers))() { \
-		int count = 0; \
-		for(auto& i:eventHandlers) count++; \
-		return count; \
+		return Core::countHandlers(); \
 	} \
 	template<typename... Args> inline void __EVENTEMITTER_CONCAT(emit,name) (Args&&... fargs) { \
-		__EVENTEMITTER_CONCAT(trigger,name)(fargs...); \
+		Core::trigger(std::forward<Args>(fargs)...); \
 	} \
-	template<typename... Args> inline void __EVENTEMITTER_CONCAT(trigger,name) (Args&&... fargs) { \
-		auto prev = eventHandlers.before_begin();  \
-	  for(auto i = eventHandlers.begin();i != eventHandlers.end();) { \
-			 \
-			(*i)(fargs...); \
-			if(i->specialFlag()) { \
-				i = eventHandlers.erase_after(prev); \
-			} \
-			else { \
-				++i; \
-				++prev; \
-			} \
+	template<typename Factory> inline void __EVENTEMITTER_CONCAT(emit,__EVENTEMITTER_CONCAT(name, Lazy)) (Factory&& factory) { \
+		if(Core::listening()) { \
+			EE::LazyArgs<Handler>::apply([this](auto&&... fargs) { \
+				this->Core::trigger(std::forward<decltype(fargs)>(fargs)...); \
+			}, factory); \
 		} \
 	} \
+	template<typename... Args> inline void __EVENTEMITTER_CONCAT(trigger,name) (Args&&... fargs) { \
+		Core::trigger(std::forward<Args>(fargs)...); \
+	} \
+	typename Core::Awaiter __EVENTEMITTER_CONCAT(next,name) (EE::DeferredBase* executor = nullptr) { \
+		return Core::next(executor); \
+	} \
+	typename Core::Stream __EVENTEMITTER_CONCAT(stream,name) (EE::DeferredBase* executor = nullptr, size_t capacity = EE::defaultStreamCapacity) { \
+		return Core::stream(executor, capacity); \
+	} \
 	bool __EVENTEMITTER_CONCAT(remove,__EVENTEMITTER_CONCAT(name, Handler)) (Handle handlerPtr) { \
-		auto prev = eventHandlers.before_begin();  \
-		for(auto i = eventHandlers.begin();i != eventHandlers.end();++i,++prev) {  \
-			if(*i == handlerPtr) { \
-				eventHandlers.erase_after(prev); \
-				return true; \
-			} \
-		} \
- 		return false; \
+		return Core::removeHandler(handlerPtr); \
 	} \
 	void __EVENTEMITTER_CONCAT(removeAll,__EVENTEMITTER_CONCAT(name, Handlers)) () { \
-		eventHandlers.clear(); \
+		Core::clearHandlers(); \
+	} \
+}; \
+ \
+template<typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::EventEmitterCore<Rest...>> { \
+};  
+
+#define __EVENTEMITTER_PROVIDER_STATIC(frontname, name)  \
+template<typename Signature, Signature*... Handlers> \
+class __EVENTEMITTER_CONCAT(frontname,StaticEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::StaticEventEmitterCore<Signature, Handlers...>> { \
+};  
+
+#define __EVENTEMITTER_PROVIDER_STICKY(frontname, name)  \
+template<size_t Depth, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,StickyEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::StickyCore<EE::EventEmitterCore<Rest...>, Depth, Rest...>> { \
+	typedef EE::StickyCore<EE::EventEmitterCore<Rest...>, Depth, Rest...> Core; \
+public: \
+	bool __EVENTEMITTER_CONCAT(last,name) (typename Core::Args& out) { \
+		return Core::last(out); \
 	} \
 };  
 
 #define __EVENTEMITTER_PROVIDER_DEFERRED(frontname, name)  \
 template<typename... Rest> \
-class __EVENTEMITTER_CONCAT(frontname,DeferredEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>, public virtual EE::DeferredBase { \
+class __EVENTEMITTER_CONCAT(frontname,DeferredEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::DeferredEventEmitterCore<Rest...>> { \
+	typedef EE::DeferredEventEmitterCore<Rest...> Core; \
 public: \
-	__EVENTEMITTER_CONCAT(frontname,DeferredEventEmitterTpl)() { \
-		DeferredBase::removeHandlers.emplace_front([=] { \
-			this->__EVENTEMITTER_CONCAT(removeAll,__EVENTEMITTER_CONCAT(name, Handlers))(); \
-		}); \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, ByRef)) (Args&&... fargs) { \
+		Core::triggerByRef(std::forward<Args>(fargs)...); \
 	} \
- \
-	template<typename... Args> inline void __EVENTEMITTER_CONCAT(emit,name) (Args&&... fargs) { \
-		__EVENTEMITTER_CONCAT(trigger,name)(fargs...); \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, WithPriority)) (EE::Priority priority, Args... fargs) { \
+		Core::triggerWithPriority(priority, fargs...); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, After)) (std::chrono::steady_clock::duration delay, Args... fargs) { \
+		return Core::triggerAfter(delay, fargs...); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, At)) (std::chrono::steady_clock::time_point when, Args... fargs) { \
+		return Core::triggerAt(when, fargs...); \
 	} \
-	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, ByRef)) (Args&&... fargs) { \
-		runDeferred( \
-			std::bind([=](Args... as) { \
-			__EVENTEMITTER_GCC_WORKAROUND __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(trigger,name)(as...); \
-			}, EE::forward_as_ref<Args>(fargs)...)); \
-	} \
-	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,name) (Args... fargs) { \
-		runDeferred( \
-			std::bind([=](Args... as) { \
-			__EVENTEMITTER_GCC_WORKAROUND __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(trigger,name)(as...); \
-			}, fargs...)); \
-	}	 \
 };  
 
 #ifndef EVENTEMITTER_DISABLE_THREADING
 
 #define __EVENTEMITTER_PROVIDER_THREADED(frontname, name)  \
 template<typename... Rest> \
-class __EVENTEMITTER_CONCAT(frontname,ThreadedEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>, public virtual EE::DeferredBase {  \
-  std::condition_variable condition; \
-	std::mutex m; \
- \
-	typedef typename __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::Handler Handler; \
-	typedef typename __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::HandlerPtr HandlerPtr; \
-	typedef typename __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::Handle Handle; \
-	 \
+class __EVENTEMITTER_CONCAT(frontname,ThreadedEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::ThreadedEventEmitterCore<Rest...>> { \
+	typedef EE::ThreadedEventEmitterCore<Rest...> Core; \
+	typedef typename Core::Handler Handler; \
+	typedef typename Core::Handle Handle; \
 public: \
-	__EVENTEMITTER_CONCAT(frontname,ThreadedEventEmitterTpl)() { \
-	}	 \
 	bool __EVENTEMITTER_CONCAT(wait,name) (std::chrono::milliseconds duration = std::chrono::milliseconds::max()) { \
-		__EVENTEMITTER_CONCAT(wait,name)([=](Rest...) { \
-		}, duration); \
- 	} \
- 	bool __EVENTEMITTER_CONCAT(wait,name) (Handler handler, std::chrono::milliseconds duration = std::chrono::milliseconds::max()) { \
-		std::shared_ptr<std::atomic<bool>> finished = std::make_shared<std::atomic<bool>>(); \
-		std::unique_lock<std::mutex> lk(m); \
-		Handle ptr = __EVENTEMITTER_CONCAT(once,name)( \
-			EE::wrapLambdaWithCallback(handler, [=]() { \
-				finished->store(true); \
-				this->condition.notify_all(); \
-		})); \
-		 \
-		if(duration == std::chrono::milliseconds::max()) { \
-			condition.wait(lk); \
-		}  \
-		else { \
-			condition.wait_for(lk, duration, [=]() { \
-				return finished->load(); \
-			}); \
-		} \
-		bool gotFinished = finished->load(); \
-		if(!gotFinished) { \
-			__EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(remove,__EVENTEMITTER_CONCAT(name, Handler))(ptr); \
-		} \
-		return gotFinished; \
- 	} \
-	void __EVENTEMITTER_CONCAT(asyncWait,name)(Handler handler, std::chrono::milliseconds duration, const std::function<void()>& asyncTimeout) { \
-		auto async = std::async(std::launch::async, [=]() { \
-			if(!__EVENTEMITTER_CONCAT(wait,name)(handler, duration)) \
-				asyncTimeout(); \
-		}); \
+		return Core::wait(duration); \
 	} \
-	 \
-	Handle __EVENTEMITTER_CONCAT(on,name) (Handler handler) { \
-		__EVENTEMITTER_LOCK_GUARD(mutex); \
-		return __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(on,name)(handler); \
+	bool __EVENTEMITTER_CONCAT(wait,name) (Handler handler, std::chrono::milliseconds duration = std::chrono::milliseconds::max()) { \
+		return Core::wait(std::move(handler), duration); \
 	} \
-	Handle __EVENTEMITTER_CONCAT(once,name) (Handler&& handler) { \
-		__EVENTEMITTER_LOCK_GUARD(mutex); \
-		return __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(once,name)(handler); \
+	void __EVENTEMITTER_CONCAT(asyncWait,name) (Handler handler, std::chrono::milliseconds duration, const std::function<void()>& asyncTimeout) { \
+		Core::asyncWait(std::move(handler), duration, asyncTimeout); \
 	} \
 	Handle __EVENTEMITTER_CONCAT(asyncOn,name) (Handler handler) { \
-		return __EVENTEMITTER_CONCAT(on,name)(EE::wrapLambdaInAsync(handler)); \
+		return Core::asyncOn(std::move(handler)); \
 	} \
 	Handle __EVENTEMITTER_CONCAT(asyncOnce,name) (Handler handler) { \
-		return __EVENTEMITTER_CONCAT(once,name)(EE::wrapLambdaInAsync(handler)); \
-	} \
-	auto __EVENTEMITTER_CONCAT(futureOnce,name)() -> decltype(std::future<std::tuple<Rest...>>()) { \
-		typedef std::tuple<Rest...> TupleEventType; \
-		auto promise = std::make_shared<std::promise<TupleEventType>>(); \
-		auto future = promise->get_future(); \
-		condition.notify_all(); \
-		__EVENTEMITTER_CONCAT(once,name)(EE::getLambdaForFuture(promise)); \
-		return future; \
+		return Core::asyncOnce(std::move(handler)); \
 	} \
-	template<typename... Args> inline void __EVENTEMITTER_CONCAT(emit,name) (Args&&... fargs) { \
-		__EVENTEMITTER_CONCAT(trigger,name)(fargs...); \
-	} \
-	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,name) (Args&&... fargs) {  \
-		__EVENTEMITTER_LOCK_GUARD(mutex); \
-		__EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(trigger,name)(fargs...); \
-		condition.notify_all(); \
+	EE::Future<std::tuple<Rest...>> __EVENTEMITTER_CONCAT(futureOnce,name) () { \
+		return Core::futureOnce(); \
 	} \
 	template<typename... Args> void __EVENTEMITTER_CONCAT(defer,__EVENTEMITTER_CONCAT(name, ByRef)) (Args&&... fargs) {  \
-		runDeferred( \
- 			std::bind([=](Args... as) { \
- 			__EVENTEMITTER_GCC_WORKAROUND __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(trigger,name)(as...); \
- 			}, \
-			EE::forward_as_ref<Args>(fargs)...			 \
-			  \
-			)); \
+		Core::deferByRef(std::forward<Args>(fargs)...); \
 	} \
 	template<typename... Args> void __EVENTEMITTER_CONCAT(defer,name) (Args... fargs) {  \
-		runDeferred( \
- 			std::bind([=](Args... as) { \
- 			__EVENTEMITTER_GCC_WORKAROUND __EVENTEMITTER_CONCAT(frontname,EventEmitterTpl)<Rest...>::__EVENTEMITTER_CONCAT(trigger,name)(as...); \
- 			}, \
-			fargs...			 \
-			  \
-			)); \
+		Core::defer(fargs...); \
+	} \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(defer,__EVENTEMITTER_CONCAT(name, WithPriority)) (EE::Priority priority, Args... fargs) {  \
+		Core::deferWithPriority(priority, fargs...); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(defer,__EVENTEMITTER_CONCAT(name, After)) (std::chrono::steady_clock::duration delay, Args... fargs) {  \
+		return Core::deferAfter(delay, fargs...); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(defer,__EVENTEMITTER_CONCAT(name, At)) (std::chrono::steady_clock::time_point when, Args... fargs) {  \
+		return Core::deferAt(when, fargs...); \
+	} \
+};  
+
+#define __EVENTEMITTER_PROVIDER_STICKY_THREADED(frontname, name)  \
+template<size_t Depth, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,StickyThreadedEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::StickyCore<EE::ThreadedEventEmitterCore<Rest...>, Depth, Rest...>> { \
+	typedef EE::StickyCore<EE::ThreadedEventEmitterCore<Rest...>, Depth, Rest...> Core; \
+public: \
+	bool __EVENTEMITTER_CONCAT(last,name) (typename Core::Args& out) { \
+		return Core::last(out); \
 	} \
 };  
 
 #endif // EVENTEMITTER_DISABLE_THREADING
 
+#define __EVENTEMITTER_PROVIDER_LOCKED(frontname, name)  \
+template<typename Lock, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,LockedEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::LockedEventEmitterCore<Lock, Rest...>> { \
+};  
+
+#ifdef __EVENTEMITTER_HAS_SHM
+
+#define __EVENTEMITTER_PROVIDER_SHARED(frontname, name)  \
+template<typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,SharedMemoryEventEmitterTpl) : public __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<EE::SharedMemoryEventEmitterCore<Rest...>> { \
+	typedef EE::SharedMemoryEventEmitterCore<Rest...> Core; \
+	typedef __EVENTEMITTER_CONCAT(frontname,EventEmitterNames)<Core> Names; \
+public: \
+	using Names::Names; \
+	size_t __EVENTEMITTER_CONCAT(receive,name) (std::chrono::microseconds timeout = std::chrono::microseconds::zero()) { \
+		return Core::receive(timeout); \
+	} \
+	uint64_t __EVENTEMITTER_CONCAT(lost,__EVENTEMITTER_CONCAT(name, Events)) () const { \
+		return Core::lostEvents(); \
+	} \
+};  
 
+#endif // __EVENTEMITTER_HAS_SHM
 
  #define __EVENTEMITTER_DISPATCHER(frontname, name)  \
-template<template<typename...> class EventDispatcherBase, typename T, typename... Rest> \
-class __EVENTEMITTER_CONCAT(frontname,EventDispatcherTpl) : public EventDispatcherBase<T, Rest...> { \
- 	using HandlerPtr =  typename EventDispatcherBase<Rest...>::HandlerPtr; \
-	using Handler = typename EventDispatcherBase<Rest...>::Handler; \
-	using Handle = typename EventDispatcherBase<Rest...>::Handle; \
-	std::multimap<T, HandlerPtr> map; \
-	bool eraseLast = false; \
+template<template<typename...> class Base, typename Table, typename T, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,EventDispatcherTableTpl) : public Base<T, Rest...> { \
+	using Handler = typename Table::Handler; \
+	using Handle = typename Table::Handle; \
+	Table table; \
 public: \
-	__EVENTEMITTER_CONCAT(frontname,EventDispatcherTpl)() { \
-		__EVENTEMITTER_CONCAT(frontname,EventEmitter)<T, Rest...>::__EVENTEMITTER_CONCAT(on,name)([&](T eventName, Rest... fargs) { \
- 			auto ret = map.equal_range(eventName); \
- 			for(auto it = ret.first;it != ret.second;) { \
- 				(it->second)(fargs...); \
-				if(eraseLast) { \
-					it = map.erase(it); \
-					eraseLast = false; \
-				} \
-				else { \
-					++it; \
-				} \
- 			} \
+	__EVENTEMITTER_CONCAT(frontname,EventDispatcherTableTpl)() { \
+		Base<T, Rest...>::__EVENTEMITTER_CONCAT(on,name)([this](T eventName, Rest... fargs) { \
+			table.dispatch(eventName, fargs...); \
 		}); \
 	} \
 	bool __EVENTEMITTER_CONCAT(has,__EVENTEMITTER_CONCAT(name, Handlers))(T eventName) { \
-		return map.find(eventName) != map.end(); \
+		return table.has(eventName); \
 	} \
 	int __EVENTEMITTER_CONCAT(count,__EVENTEMITTER_CONCAT(name, Handlers))(T eventName) { \
-		int count = 0; \
-		auto ret = map.equal_range(eventName); \
-		for(auto it = ret.first;it != ret.second;++it) \
-			count++; \
-		return count; \
+		return table.count(eventName); \
+	} \
+	template<typename Factory> void __EVENTEMITTER_CONCAT(emit,__EVENTEMITTER_CONCAT(name, Lazy)) (const T& eventName, Factory&& factory) { \
+		if(table.listening(eventName)) { \
+			EE::LazyArgs<Handler>::apply([&](auto&&... fargs) { \
+				this->__EVENTEMITTER_CONCAT(emit,name)(eventName, std::forward<decltype(fargs)>(fargs)...); \
+			}, factory); \
+		} \
 	} \
-	 \
  	Handle __EVENTEMITTER_CONCAT(on,name) (T eventName, Handler handler) { \
-		return map.insert(std::pair<T, Handler>(eventName,  handler))->second; \
+		return table.on(std::move(eventName), std::move(handler)); \
  	} \
  	Handle __EVENTEMITTER_CONCAT(once,name) (T eventName, Handler handler) { \
-		return map.insert(std::pair<T, Handler>(eventName,   \
-			EE::wrapLambdaWithCallback(handler, [&] { \
-				eraseLast = true; \
-			})))->second; \
+		return table.once(std::move(eventName), std::move(handler)); \
  	} \
  	bool __EVENTEMITTER_CONCAT(remove,__EVENTEMITTER_CONCAT(name, Handler)) (T eventName, Handle handler) { \
-		auto ret = map.equal_range(eventName); \
-		for(auto it = ret.first;it != ret.second;++it) { \
-			if(it->second == handler) { \
-				it = map.erase(it); \
-				return true; \
-			} \
-		} \
-		return false; \
+		return table.remove(eventName, handler); \
+	} \
+	void __EVENTEMITTER_CONCAT(removeAll,__EVENTEMITTER_CONCAT(name, Handlers)) (T eventName) { \
+		table.removeAll(eventName); \
+	} \
+}; \
+template<template<typename...> class Base, typename T, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,EventDispatcherTpl) : public __EVENTEMITTER_CONCAT(frontname,EventDispatcherTableTpl)<Base, EE::DispatchTable<T, Rest...>, T, Rest...> { \
+}; \
+template<template<typename...> class Base, size_t Depth, typename T, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,StickyEventDispatcherTpl) : public __EVENTEMITTER_CONCAT(frontname,EventDispatcherTableTpl)<Base, EE::StickyDispatchTable<Depth, T, Rest...>, T, Rest...> { \
+};  
+
+#define __EVENTEMITTER_DISPATCHER_DEFERRED(frontname, name)  \
+template<typename T, typename... Rest> \
+class __EVENTEMITTER_CONCAT(frontname,EventDispatcherTpl)<__EVENTEMITTER_CONCAT(frontname,DeferredEventEmitterTpl), T, Rest...> : public __EVENTEMITTER_CONCAT(frontname,DeferredEventEmitterTpl)<T, Rest...> { \
+	typedef EE::InternedDispatchTable<T, Rest...> Table; \
+	using Handler = typename Table::Handler; \
+	using Handle = typename Table::Handle; \
+	Table table; \
+public: \
+	bool __EVENTEMITTER_CONCAT(has,__EVENTEMITTER_CONCAT(name, Handlers))(T eventName) { \
+		return table.has(eventName); \
+	} \
+	int __EVENTEMITTER_CONCAT(count,__EVENTEMITTER_CONCAT(name, Handlers))(T eventName) { \
+		return table.count(eventName); \
+	} \
+	Handle __EVENTEMITTER_CONCAT(on,name) (T eventName, Handler handler) { \
+		return table.on(std::move(eventName), std::move(handler)); \
+	} \
+	Handle __EVENTEMITTER_CONCAT(once,name) (T eventName, Handler handler) { \
+		return table.once(std::move(eventName), std::move(handler)); \
+	} \
+	bool __EVENTEMITTER_CONCAT(remove,__EVENTEMITTER_CONCAT(name, Handler)) (T eventName, Handle handler) { \
+		return table.remove(eventName, handler); \
 	} \
 	void __EVENTEMITTER_CONCAT(removeAll,__EVENTEMITTER_CONCAT(name, Handlers)) (T eventName) { \
-		auto ret = map.equal_range(eventName); \
-		for(auto it = ret.first;it != ret.second;) {		 \
-			it = map.erase(it); \
+		table.removeAll(eventName); \
+	} \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, WithPriority)) (EE::Priority priority, const T& eventName, Args&&... fargs) { \
+		uint32_t id = table.find(eventName); \
+		if(id == Table::npos) { \
+			return; \
+		} \
+		this->post(typename Table::Call{&table, id, std::forward_as_tuple(fargs...)}, priority); \
+	} \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,name) (const T& eventName, Args&&... fargs) { \
+		__EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, WithPriority))(EE::Priority::Normal, eventName, std::forward<Args>(fargs)...); \
+	} \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(emit,name) (const T& eventName, Args&&... fargs) { \
+		__EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, WithPriority))(EE::Priority::Normal, eventName, std::forward<Args>(fargs)...); \
+	} \
+	template<typename Factory> void __EVENTEMITTER_CONCAT(emit,__EVENTEMITTER_CONCAT(name, Lazy)) (const T& eventName, Factory&& factory) { \
+		uint32_t id = table.find(eventName); \
+		if(id == Table::npos) { \
+			return; \
+		} \
+		EE::LazyArgs<Handler>::apply([&](auto&&... fargs) { \
+			this->post(typename Table::Call{&table, id, std::forward_as_tuple(fargs...)}, EE::Priority::Normal); \
+		}, factory); \
+	} \
+	template<typename... Args> void __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, ByRef)) (const T& eventName, Args&&... fargs) { \
+		__EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, WithPriority))(EE::Priority::Normal, eventName, std::forward<Args>(fargs)...); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, At)) (std::chrono::steady_clock::time_point when, const T& eventName, Args&&... fargs) { \
+		uint32_t id = table.find(eventName); \
+		if(id == Table::npos) { \
+			return 0; \
 		} \
+		return this->runDeferredAt(when, typename Table::Call{&table, id, std::forward_as_tuple(fargs...)}); \
+	} \
+	template<typename... Args> EE::DeferredBase::TimerHandle __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, After)) (std::chrono::steady_clock::duration delay, const T& eventName, Args&&... fargs) { \
+		return __EVENTEMITTER_CONCAT(trigger,__EVENTEMITTER_CONCAT(name, At))(std::chrono::steady_clock::now() + delay, eventName, std::forward<Args>(fargs)...); \
 	} \
- };  
+};  
 
 
 
@@ -446,6 +5611,27 @@ typedef __EVENTEMITTER_CONCAT(name, EventEmitterTpl)<__VA_ARGS__> className;
 
 #define DefineEventEmitter(name, ...) DefineEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, EventEmitter), __VA_ARGS__);
 
+#define DefineStaticEventEmitterAs(name, className, signature, ...) \
+__EVENTEMITTER_PROVIDER(name,name) \
+__EVENTEMITTER_PROVIDER_STATIC(name,name) \
+typedef __EVENTEMITTER_CONCAT(name, StaticEventEmitterTpl)<signature, __VA_ARGS__> className;
+
+#define DefineStaticEventEmitter(name, signature, ...) DefineStaticEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, StaticEventEmitter), signature, __VA_ARGS__)
+
+#define DefineStickyEventEmitterAs(name, className, depth, ...) \
+__EVENTEMITTER_PROVIDER(name,name) \
+__EVENTEMITTER_PROVIDER_STICKY(name,name) \
+typedef __EVENTEMITTER_CONCAT(name, StickyEventEmitterTpl)<depth, __VA_ARGS__> className;
+
+#define DefineStickyEventEmitter(name, depth, ...) DefineStickyEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, StickyEventEmitter), depth, __VA_ARGS__)
+
+#define DefineStickyThreadedEventEmitterAs(name, className, depth, ...) \
+__EVENTEMITTER_PROVIDER(name,name) \
+__EVENTEMITTER_PROVIDER_STICKY_THREADED(name,name) \
+typedef __EVENTEMITTER_CONCAT(name, StickyThreadedEventEmitterTpl)<depth, __VA_ARGS__> className;
+
+#define DefineStickyThreadedEventEmitter(name, depth, ...) DefineStickyThreadedEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, StickyThreadedEventEmitter), depth, __VA_ARGS__)
+
 #define DefineDeferredEventEmitterAs(name, className, ...) \
 __EVENTEMITTER_PROVIDER(name,name) \
 __EVENTEMITTER_PROVIDER_DEFERRED(name,name) \
@@ -458,17 +5644,49 @@ __EVENTEMITTER_PROVIDER(name,name) \
 __EVENTEMITTER_PROVIDER_THREADED(name,name) \
 typedef __EVENTEMITTER_CONCAT(name, ThreadedEventEmitterTpl)<__VA_ARGS__> className;
 
-#define DefineThreadedEventEmitter(name, ...) __EVENTEMITTER_CONCAT(name, ThreadedEventEmitter), __VA_ARGS__)
+#define DefineThreadedEventEmitter(name, ...) DefineThreadedEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, ThreadedEventEmitter), __VA_ARGS__)
+
+#define DefineLockedEventEmitterAs(name, className, lock, ...) \
+__EVENTEMITTER_PROVIDER(name,name) \
+__EVENTEMITTER_PROVIDER_LOCKED(name,name) \
+typedef __EVENTEMITTER_CONCAT(name, LockedEventEmitterTpl)<lock, __VA_ARGS__> className;
+
+#define DefineLockedEventEmitter(name, lock, ...) DefineLockedEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, LockedEventEmitter), lock, __VA_ARGS__)
+
+#define DefineSharedMemoryEventEmitterAs(name, className, ...) \
+__EVENTEMITTER_PROVIDER(name,name) \
+__EVENTEMITTER_PROVIDER_SHARED(name,name) \
+typedef __EVENTEMITTER_CONCAT(name, SharedMemoryEventEmitterTpl)<__VA_ARGS__> className;
+
+#define DefineSharedMemoryEventEmitter(name, ...) DefineSharedMemoryEventEmitterAs(name, __EVENTEMITTER_CONCAT(name, SharedMemoryEventEmitter), __VA_ARGS__)
 
 __EVENTEMITTER_PROVIDER(,)
 template<typename... Rest> class EventEmitter : public EventEmitterTpl<Rest...> {};
 
+__EVENTEMITTER_PROVIDER_STATIC(,)
+template<typename Signature, Signature*... Handlers> class StaticEventEmitter : public StaticEventEmitterTpl<Signature, Handlers...> {};
+
+__EVENTEMITTER_PROVIDER_STICKY(,)
+template<size_t Depth, typename... Rest> class StickyEventEmitter : public StickyEventEmitterTpl<Depth, Rest...> {};
+
 __EVENTEMITTER_PROVIDER_DEFERRED(,)
 
 template<typename... Rest> class DeferredEventEmitter : public DeferredEventEmitterTpl<Rest...> {};
 
 #ifndef EVENTEMITTER_DISABLE_THREADING
 __EVENTEMITTER_PROVIDER_THREADED(,)
+__EVENTEMITTER_PROVIDER_STICKY_THREADED(,)
+#endif
+
+__EVENTEMITTER_PROVIDER_LOCKED(,)
+template<typename Lock, typename... Rest> class LockedEventEmitter : public LockedEventEmitterTpl<Lock, Rest...> {};
+
+#ifdef __EVENTEMITTER_HAS_SHM
+__EVENTEMITTER_PROVIDER_SHARED(,)
+template<typename... Rest> class SharedMemoryEventEmitter : public SharedMemoryEventEmitterTpl<Rest...> {
+public:
+	using SharedMemoryEventEmitterTpl<Rest...>::SharedMemoryEventEmitterTpl;
+};
 #endif
 
 
@@ -1,9 +1,38 @@
 #include "EventEmitter.hpp"
 
 #include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 DefineDeferredEventEmitter(Test)
 
+static long long hookTotal;
+void metricsHook(int value) {
+	hookTotal += value;
+}
+void auditHook(int value) {
+	hookTotal ^= value;
+}
+DefineStaticEventEmitter(Hooked, void(int), &metricsHook, &auditHook)
+DefineEventEmitter(Dynamic, int)
+DefineEventEmitter(Log, std::string)
+#ifndef EVENTEMITTER_DISABLE_THREADING
+DefineThreadedEventEmitter(Request, int)
+DefineThreadedEventEmitter(Response, int)
+DefineLockedEventEmitter(Mutexed, EE::MutexLock, int)
+DefineLockedEventEmitter(Spin, EE::SpinLock, int)
+DefineLockedEventEmitter(Shared, EE::SharedLock, int)
+#endif
+
+template<typename F> void measure(const char* name, int iterations, F f, const char* unit = "round-trips/s") {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << name << ": " << (long long)(iterations / elapsed.count()) << " " << unit << "\n";
+}
+
 int main(void)
 {
 	TestDeferredEventEmitter provider;
@@ -26,5 +55,218 @@ int main(void)
 	for(int i = 0;i < 10;++i) {
 		assert(counter[i] == 100000);
 	}
+
+	// unsubscribing many handlers: removeTestHandler scans the list per
+	// call (quadratic, hence the smaller count), ScopedConnection is
+	// dropped by a single trigger
+	const int subscriptions = 100000;
+	measure("removeHandler teardown", subscriptions / 10, [&] {
+		std::vector<TestDeferredEventEmitter::Handle> handles;
+		for(int i = 0;i < subscriptions / 10;++i) {
+			handles.push_back(provider.onTest([] {}));
+		}
+		while(!handles.empty()) {
+			provider.removeTestHandler(handles.back());
+			handles.pop_back();
+		}
+	}, "handlers/s");
+	measure("ScopedConnection teardown", subscriptions, [&] {
+		std::vector<EE::ScopedConnection> connections;
+		for(int i = 0;i < subscriptions;++i) {
+			connections.push_back(provider.connectTest([] {}));
+		}
+		connections.clear();
+		provider.triggerTest();
+		provider.runAllDeferred();
+	}, "handlers/s");
+
+	// a million delayed events spread over 100ms: scheduling, cancelling
+	// every other one and draining the rest once all are due
+	const int timers = 1000000;
+	TestDeferredEventEmitter delayed;
+	int fired = 0;
+	delayed.onTest([&] {
+		fired++;
+	});
+	std::vector<EE::DeferredBase::TimerHandle> timerHandles(timers);
+	measure("triggerAfter", timers, [&] {
+		for(int i = 0;i < timers;++i) {
+			timerHandles[i] = delayed.triggerTestAfter(std::chrono::milliseconds(1 + i % 100));
+		}
+	}, "timers/s");
+	measure("cancelDeferred", timers / 2, [&] {
+		for(int i = 1;i < timers;i += 2) {
+			delayed.cancelDeferred(timerHandles[i]);
+		}
+	}, "timers/s");
+	std::this_thread::sleep_for(std::chrono::milliseconds(110));
+	measure("expired timers drained", timers / 2, [&] {
+		delayed.runAllDeferred();
+	}, "timers/s");
+	assert(fired == timers / 2);
+
+	// two fixed hooks: compile time handler list against std::function ones
+	const int hookTriggers = 10000000;
+	HookedStaticEventEmitter hooked;
+	DynamicEventEmitter dynamic;
+	dynamic.onDynamic(metricsHook);
+	dynamic.onDynamic(auditHook);
+	measure("StaticEventEmitter, 2 hooks", hookTriggers, [&] {
+		for(int i = 0;i < hookTriggers;++i) {
+			hooked.triggerHooked(i);
+		}
+	}, "triggers/s");
+	measure("EventEmitter, 2 hooks", hookTriggers, [&] {
+		for(int i = 0;i < hookTriggers;++i) {
+			dynamic.triggerDynamic(i);
+		}
+	}, "triggers/s");
+
+	// many subscribers, each interested in one symbol: handlers testing
+	// the symbol themselves against an index calling only the matching one
+	const int symbols = 10000, quotes = 20000;
+	DynamicEventEmitter checking, filtered;
+	EE::FilterIndex<int, int> bySymbol([](int symbol) {
+		return symbol;
+	});
+	for(int s = 0;s < symbols;++s) {
+		checking.onDynamic([s](int symbol) {
+			if(symbol != s) {
+				return;
+			}
+			hookTotal++;
+		});
+		filtered.onDynamic(bySymbol.equals(s), [](int) {
+			hookTotal++;
+		});
+	}
+	measure("10000 handlers checking the symbol", quotes, [&] {
+		for(int i = 0;i < quotes;++i) {
+			checking.triggerDynamic(i % symbols);
+		}
+	}, "triggers/s");
+	measure("10000 handlers in a FilterIndex", quotes, [&] {
+		for(int i = 0;i < quotes;++i) {
+			filtered.triggerDynamic(i % symbols);
+		}
+	}, "triggers/s");
+
+	// nobody listening: formatting the payload anyway against a factory
+	// that is never called
+	const int unheard = 10000000;
+	LogEventEmitter log;
+	measure("emit to no handlers", unheard, [&] {
+		for(int i = 0;i < unheard;++i) {
+			log.emitLog("request " + std::to_string(i) + " served");
+		}
+	}, "emits/s");
+	measure("emitLazy to no handlers", unheard, [&] {
+		for(int i = 0;i < unheard;++i) {
+			log.emitLogLazy([i] {
+				return "request " + std::to_string(i) + " served";
+			});
+		}
+	}, "emits/s");
+
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	// request/response: the responder answers inline, so this measures the
+	// cost of futureOnce and get() themselves
+	const int roundTrips = 200000;
+	RequestThreadedEventEmitter requests;
+	ResponseThreadedEventEmitter responses;
+	requests.onRequest([&](int value) {
+		responses.triggerResponse(value + 1);
+	});
+	measure("futureOnce + get", roundTrips, [&] {
+		for(int i = 0;i < roundTrips;++i) {
+			auto future = responses.futureOnceResponse();
+			requests.triggerRequest(i);
+			assert(std::get<0>(future.get()) == i + 1);
+		}
+	});
+	measure("futureOnce + then", roundTrips, [&] {
+		int received = 0;
+		for(int i = 0;i < roundTrips;++i) {
+			responses.futureOnceResponse().then([&](std::tuple<int> t) {
+				received = std::get<0>(t);
+			});
+			requests.triggerRequest(i);
+			assert(received == i + 1);
+		}
+	});
+	measure("std::promise baseline", roundTrips, [&] {
+		for(int i = 0;i < roundTrips;++i) {
+			auto promise = std::make_shared<std::promise<std::tuple<int>>>();
+			auto future = promise->get_future();
+			responses.onceResponse([promise](int value) {
+				promise->set_value(std::tuple<int>(value));
+			});
+			requests.triggerRequest(i);
+			assert(std::get<0>(future.get()) == i + 1);
+		}
+	});
+
+	// read-mostly emitters triggered from several threads at once, the
+	// handler only touches thread local state
+	const int threads = 4, triggers = 500000;
+	auto handler = [](int value) {
+		static thread_local long long sum;
+		sum += value;
+	};
+	auto contended = [&](const char* name, auto trigger) {
+		measure(name, threads * triggers, [&] {
+			std::vector<std::thread> workers;
+			for(int t = 0;t < threads;++t) {
+				workers.emplace_back([&] {
+					for(int i = 0;i < triggers;++i) {
+						trigger(i);
+					}
+				});
+			}
+			for(auto& worker : workers) {
+				worker.join();
+			}
+		}, "triggers/s");
+	};
+	RequestThreadedEventEmitter threaded;
+	MutexedLockedEventEmitter mutexed;
+	SpinLockedEventEmitter spin;
+	SharedLockedEventEmitter shared;
+	threaded.onRequest(handler);
+	mutexed.onMutexed(handler);
+	spin.onSpin(handler);
+	shared.onShared(handler);
+	contended("ThreadedEventEmitter, 4 threads", [&](int i) { threaded.triggerRequest(i); });
+	contended("LockedEventEmitter<MutexLock>, 4 threads", [&](int i) { mutexed.triggerMutexed(i); });
+	contended("LockedEventEmitter<SpinLock>, 4 threads", [&](int i) { spin.triggerSpin(i); });
+	contended("LockedEventEmitter<SharedLock>, 4 threads", [&](int i) { shared.triggerShared(i); });
+
+	// three stages on their own threads connected by SPSC rings
+	const int staged = 1000000;
+	EE::Pipeline pipeline;
+	auto& parse = pipeline.stage<int>();
+	auto& enrich = pipeline.stage<int, int>();
+	auto& publish = pipeline.stage<int, int>();
+	long long published = 0;
+	parse.on([&](int value) {
+		enrich.push(value, 0);
+	});
+	enrich.on([&](int value, int) {
+		publish.push(value, value * 2);
+	});
+	publish.on([&](int value, int doubled) {
+		published += doubled - value;
+	});
+	pipeline.start();
+	measure("Pipeline, 3 stages", staged, [&] {
+		for(int i = 0;i < staged;++i) {
+			parse.push(i);
+		}
+		pipeline.stop();
+	}, "events/s");
+	for(auto& stage : pipeline.metrics()) {
+		std::cout << "  stage: " << stage.processed << " processed, " << stage.stalls << " stalls\n";
+	}
+#endif
 	return 0;
 }
@@ -0,0 +1,29 @@
+#!/usr/bin/perl
+# Emits a translation unit declaring and using N emitter types, used by
+# `make buildbench` to track compile time and code size of the header.
+
+my $count = shift || 200;
+
+print "#include \"EventEmitter.hpp\"\n#include <string>\n\n";
+for my $i (0 .. $count - 1) {
+	print "DefineThreadedEventEmitter(Event$i, int, std::string)\n";
+}
+print "\nint sum = 0;\n\n";
+for my $i (0 .. $count - 1) {
+	print <<"END";
+void use$i() {
+	Event${i}ThreadedEventEmitter emitter;
+	auto handle = emitter.onEvent$i([](int a, std::string) { sum += a; });
+	emitter.onceEvent$i([](int a, std::string) { sum -= a; });
+	emitter.triggerEvent$i($i, "a");
+	emitter.deferEvent$i($i, "b");
+	emitter.runAllDeferred();
+	emitter.removeEvent${i}Handler(handle);
+}
+END
+}
+print "\nint main() {\n";
+for my $i (0 .. $count - 1) {
+	print "\tuse$i();\n";
+}
+print "\treturn sum;\n}\n";
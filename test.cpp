@@ -3,6 +3,13 @@
 
 #include <exception>
 #include <iostream>
+#include <thread>
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+#include <poll.h>
+#endif
+#ifdef __EVENTEMITTER_HAS_SHM
+#include <sys/wait.h>
+#endif
 
 class test_exception: public std::exception
 {
@@ -42,6 +49,35 @@ typedef ExampleThreadedEventEmitterTpl<int, int, std::string> ExampleThreadedEve
 typedef ExampleEventDispatcherTpl<ExampleEventEmitterTpl, std::string, int, int, std::string> ExampleEventDispatcherImpl;
 
 typedef ExampleEventDispatcherTpl<ExampleDeferredEventEmitterTpl, std::string, int, int, std::string> ExampleDeferredEventDispatcherImpl;
+struct Connect : EE::Event<int> {};
+struct Data : EE::Event<std::string, int> {};
+struct Close : EE::Event<> {};
+typedef EE::EventSet<Connect, Data, Close> ConnectionEvents;
+
+std::string staticCalls;
+void staticMetrics(int a, int, std::string) {
+	staticCalls += "m" + std::to_string(a);
+}
+void staticAudit(int a, int, std::string str) {
+	staticCalls += "a" + str;
+}
+typedef ExampleStaticEventEmitterTpl<void(int, int, std::string), &staticMetrics, &staticAudit> ExampleStaticEventEmitterImpl;
+
+#ifdef __EVENTEMITTER_HAS_SHM
+typedef ExampleSharedMemoryEventEmitterTpl<int, int, double> ExampleSharedMemoryEventEmitterImpl;
+#endif
+
+#ifdef __EVENTEMITTER_HAS_COROUTINES
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+#endif
 
 
 int main()
@@ -104,19 +140,740 @@ int main()
 	}, "EventEmitter - removeAllHandlers");
 	
 	
-	// TODO: make this work!!
-	// 		runTest([] {
-	// 			ExampleEventEmitter test;
-	// 			
-	// 			int sum = 0;
-	// 			ExampleEventEmitter::HandlerPtr ptr =  test.onExample([&](int a, int b, std::string str) {
-	// 				sum += a;
-	// 				test.removeExampleHandler(ptr);
-	// 			});
-	// 			test.triggerExample(11, 13, "B");
-	// 			assert(sum == 11, "removeExampleHandler: third trigger should not run");
-	// 			assert(sum == 16, "removeExampleHandler: once handler should have been removed");			
-	// 		}, "EventEmitter - removeHandler from within self");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		std::string order;
+		test.onExample([&](int, int, std::string) { order += "n1"; });
+		test.onExample([&](int, int, std::string) { order += "l1"; }, EE::Priority::Low);
+		test.onExample([&](int, int, std::string) { order += "c1"; }, EE::Priority::Critical);
+		auto handle = test.onExample([&](int, int, std::string) { order += "n2"; });
+		test.onceExample([&](int, int, std::string) { order += "c2"; }, EE::Priority::Critical);
+		test.onExample([&](int, int, std::string) { order += "h1"; }, EE::Priority::High);
+		test.triggerExample(0, 0, "");
+		assert(order == "c1c2h1n1n2l1", "handlers should run by band, in registration order within a band");
+		
+		order.clear();
+		test.removeExampleHandler(handle);
+		test.onExample([&](int, int, std::string) { order += "n3"; });
+		test.onExample([&](int, int, std::string) { order += "c3"; }, EE::Priority::Critical);
+		test.triggerExample(0, 0, "");
+		assert(order == "c1c3h1n1n3l1", "removing handlers should keep bands consistent");
+	}, "EventEmitter - handler priority");
+	runTest([] {
+		assert(sizeof(ExampleEventEmitterImpl) == sizeof(void*), "empty emitter should be one pointer");
+		assert(sizeof(ExampleEventEmitterImpl::HandlerPtr) <= sizeof(ExampleEventEmitterImpl::Handler) + 8, "handler entry should be the callable plus id and band");
+		assert(sizeof(ExampleDeferredEventEmitterImpl) <= 6 * sizeof(void*), "deferred emitter should allocate its queue lazily");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		assert(sizeof(ExampleThreadedEventEmitterImpl) <= 7 * sizeof(void*), "threaded emitter should allocate its mutex lazily");
+		ExampleThreadedEventEmitterImpl threaded;
+		threaded.triggerExample(1, 2, "A");
+		assert(!threaded.runDeferred(), "runDeferred: should be a no-op before anything is queued");
+		int sum = 0;
+		threaded.onExample([&](int a, int b, std::string) {
+			sum += a + b;
+		});
+		threaded.deferExample(1, 2, "B");
+		threaded.runAllDeferred();
+		threaded.triggerExample(3, 4, "C");
+		assert(sum == 10, "lazily allocated state should work once created");
+#endif
+	}, "EventEmitter - memory footprint");
+	runTest([] {
+		struct Listener {
+			int sum = 0;
+			void handle(int a, int b, std::string) {
+				sum += a + b;
+			}
+		};
+		ExampleEventEmitterImpl test;
+		auto listener = std::make_shared<Listener>();
+		test.onExample(std::weak_ptr<Listener>(listener), &Listener::handle);
+		int scoped = 0;
+		{
+			auto connection = test.connectExample([&](int a, int b, std::string) {
+				scoped++;
+			});
+			test.triggerExample(1, 2, "A");
+			assert(connection.connected(), "connected: should be true while in scope");
+		}
+		assert(listener->sum == 3 && scoped == 1, "trigger: should reach owned and scoped handlers");
+		auto copy = listener;
+		listener.reset();
+		test.triggerExample(1, 2, "B");
+		assert(copy->sum == 6 && scoped == 1, "trigger: should skip handlers whose connection is gone");
+		copy.reset();
+		test.triggerExample(1, 2, "C");
+		assert(!test.hasExampleHandlers(), "trigger: should reclaim handlers of expired owners");
+		
+		std::vector<EE::ScopedConnection> connections;
+		for(int i = 0;i < 100000;++i) {
+			connections.push_back(test.connectExample([](int, int, std::string) {}));
+		}
+		assert(test.countExampleHandlers() == 100000, "connect: should add every handler");
+		connections.clear();
+		test.triggerExample(0, 0, "D");
+		assert(test.countExampleHandlers() == 0, "trigger: should reclaim all disconnected handlers in one pass");
+	}, "EventEmitter - weak owners and ScopedConnection");
+	
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		
+		int sum = 0;
+		ExampleEventEmitterImpl::Handle ptr = test.onExample([&](int a, int b, std::string str) {
+			sum += a;
+			test.removeExampleHandler(ptr);
+		});
+		test.triggerExample(11, 13, "A");
+		assert(sum == 11, "removeExampleHandler: handler should run once");
+		test.triggerExample(11, 13, "B");
+		assert(sum == 11, "removeExampleHandler: second trigger should not run");
+		assert(!test.hasExampleHandlers(), "removeExampleHandler: handler should be gone");
+	}, "EventEmitter - removeHandler from within self");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		std::string order;
+		ExampleEventEmitterImpl::Handle second = 0;
+		test.onExample([&](int, int, std::string) {
+			order += "a";
+			test.removeExampleHandler(second);
+			test.onExample([&](int, int, std::string) {
+				order += "n";
+			});
+		});
+		second = test.onExample([&](int, int, std::string) {
+			order += "b";
+		});
+		test.onExample([&](int depth, int, std::string) {
+			order += "c";
+			if(depth < 2) {
+				test.triggerExample(depth + 1, 0, "nested");
+			}
+		});
+		test.triggerExample(0, 0, "A");
+		assert(order == "acacac", "trigger: removals apply at once, additions wait for the next trigger");
+		order.clear();
+		test.triggerExample(2, 0, "B");
+		assert(order == "acnnn", "trigger: handlers added during trigger run on the next one");
+		assert(test.countExampleHandlers() == 6, "trigger: tombstones should be compacted");
+
+		ExampleEventEmitterImpl urgent;
+		order.clear();
+		urgent.onceExample([&](int, int, std::string) {
+			order += "o";
+			urgent.onExample([&](int, int, std::string) {
+				order += "u";
+			}, EE::Priority::Critical);
+		});
+		ExampleEventEmitterImpl::Handle self = 0;
+		self = urgent.onExample([&](int, int, std::string) {
+			order += "s";
+			urgent.removeExampleHandler(self);
+			urgent.onExample([&](int, int, std::string) {
+				order += "v";
+			}, EE::Priority::Critical);
+		});
+		urgent.triggerExample(0, 0, "A");
+		urgent.triggerExample(0, 0, "B");
+		assert(order == "osuv" && urgent.countExampleHandlers() == 2, "trigger: a spent handler subscribing ahead of itself should not lose the new handler");
+	}, "EventEmitter - add and remove handlers during trigger");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		const int count = 64;
+		std::vector<ExampleEventEmitterImpl::Handle> handles(count);
+		std::vector<bool> removed(count, false);
+		std::vector<int> calls(count, 0);
+		bool ok = true;
+		unsigned seed = 12345;
+		auto random = [&] {
+			seed = seed * 1103515245 + 12345;
+			return (seed >> 16) % count;
+		};
+		for(int i = 0;i < count;++i) {
+			handles[i] = test.onExample([&, i](int depth, int, std::string) {
+				if(removed[i]) {
+					ok = false;
+				}
+				calls[i]++;
+				int victim = random();
+				if(!removed[victim]) {
+					removed[victim] = true;
+					test.removeExampleHandler(handles[victim]);
+				}
+				if(depth < 3 && random() % 8 == 0) {
+					test.triggerExample(depth + 1, 0, "");
+				}
+			});
+		}
+		for(int round = 0;round < 20 && test.hasExampleHandlers();++round) {
+			test.triggerExample(0, 0, "");
+		}
+		int alive = 0;
+		for(int i = 0;i < count;++i) {
+			alive += !removed[i];
+		}
+		assert(ok, "stress: removed handlers should never run");
+		assert(test.countExampleHandlers() == alive, "stress: count should match live handlers");
+	}, "EventEmitter - mutation during nested trigger stress");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		int calls = 0;
+		test.onExample([&](int, int, std::string) {
+			calls++;
+			throw std::runtime_error("first");
+		});
+		test.onceExample([&](int, int, std::string) {
+			calls++;
+			throw std::logic_error("second");
+		});
+		test.onExample([&](int, int, std::string) {
+			calls++;
+		});
+		std::string caught;
+		try {
+			test.triggerExample(0, 0, "A");
+		} catch(std::runtime_error& e) {
+			caught = e.what();
+		}
+		assert(caught == "first" && calls == 3, "Propagate: should run all handlers and rethrow the first error");
+		assert(test.countExampleHandlers() == 2, "Propagate: a throwing once handler should be erased");
+		
+		test.setExampleErrorPolicy(EE::ErrorPolicy::Aggregate);
+		test.onceExample([&](int, int, std::string) {
+			throw std::logic_error("second");
+		});
+		size_t aggregated = 0;
+		try {
+			test.triggerExample(0, 0, "B");
+		} catch(EE::HandlerErrors& e) {
+			aggregated = e.errors.size();
+		}
+		assert(aggregated == 2, "Aggregate: should collect every error of the trigger");
+		
+		int routed = 0;
+		test.setExampleErrorPolicy(EE::ErrorPolicy::Route, [&](std::exception_ptr) {
+			routed++;
+		});
+		test.triggerExample(0, 0, "C");
+		assert(routed == 1 && calls == 7, "Route: should hand errors to the error handler");
+		
+		ExampleDeferredEventEmitterImpl deferred;
+		int deferredCalls = 0;
+		deferred.onExample([&](int, int, std::string) {
+			if(deferredCalls++ == 0) {
+				throw std::runtime_error("deferred");
+			}
+		});
+		deferred.triggerExample(0, 0, "D");
+		deferred.triggerExample(0, 0, "E");
+		bool thrown = false;
+		try {
+			deferred.runAllDeferred();
+		} catch(std::runtime_error&) {
+			thrown = true;
+		}
+		deferred.runAllDeferred();
+		assert(thrown && deferredCalls == 2, "runDeferred: a throwing event should be popped and not rerun");
+	}, "EventEmitter - error policies");
+	runTest([] {
+		EE::CollectingEventEmitter<const char*(int)> lookup;
+		assert(!lookup.emitCollect(EE::FirstValue(), (const char*)nullptr, 1), "emitCollect: should return init without handlers");
+		int asked = 0;
+		lookup.on([&](int key) -> const char* {
+			asked++;
+			return nullptr;
+		});
+		lookup.on([&](int key) -> const char* {
+			asked++;
+			return key == 1 ? "one" : nullptr;
+		});
+		lookup.on([&](int key) -> const char* {
+			asked++;
+			return "fallback";
+		});
+		assert(std::string(lookup.emitCollect(EE::FirstValue(), (const char*)nullptr, 1)) == "one", "FirstValue: should return the first non-null answer");
+		assert(asked == 2, "FirstValue: should stop asking after the first answer");
+		assert(std::string(lookup.emitCollect(EE::FirstValue(), (const char*)nullptr, 2)) == "fallback", "FirstValue: should ask later handlers");
+		auto all = lookup.emitCollect(EE::CollectAll(), std::vector<const char*>(), 1);
+		assert(all.size() == 3 && std::string(all[1]) == "one", "CollectAll: should collect answers in order");
+		
+		EE::CollectingEventEmitter<bool(int)> checks;
+		checks.on([](int v) { return v > 0; });
+		checks.on([](int v) { return v < 10; });
+		assert(checks.emitCollect(EE::AllOf(), true, 5), "AllOf: should be true when all agree");
+		assert(!checks.emitCollect(EE::AllOf(), true, 50), "AllOf: should be false when one disagrees");
+		assert(checks.emitCollect(EE::AnyOf(), false, 50), "AnyOf: should be true when one agrees");
+		assert(checks.emitCollect([](int& sum, bool v) { sum += v; return true; }, 0, 5) == 2, "emitCollect: should accept a custom reducer");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		EE::CollectingEventEmitter<int(int)> workers;
+		for(int i = 0;i < 64;++i) {
+			workers.on([i](int v) {
+				return i == 40 ? v : 0;
+			});
+		}
+		assert(workers.emitCollectParallel(EE::CollectAll(), std::vector<int>(), 7).size() == 64, "emitCollectParallel: should collect every answer");
+		assert(workers.emitCollectParallel(EE::FirstValue(), 0, 7) == 7, "emitCollectParallel: should find the first answer");
+		for(int i = 0;i < 16;++i) {
+			workers.once([](int v) {
+				return v;
+			});
+		}
+		assert(workers.emitCollectParallel(EE::CollectAll(), std::vector<int>(), 1).size() == 80, "emitCollectParallel: should run once handlers");
+		assert(workers.countHandlers() == 64, "emitCollectParallel: should erase once handlers afterwards");
+
+		EE::CollectingEventEmitter<int(int)> early;
+		std::atomic<int> calledOnce(0);
+		early.on([](int v) {
+			return v;
+		});
+		for(int i = 0;i < 63;++i) {
+			early.once([&](int v) {
+				calledOnce++;
+				return v;
+			});
+		}
+		assert(early.emitCollectParallel(EE::FirstValue(), 0, 3) == 3, "emitCollectParallel: should stop at the first answer");
+		assert(early.countHandlers() == 64 - calledOnce, "emitCollectParallel: once handlers not calledOnce should stay subscribed");
+		size_t left = 64 - calledOnce;
+		assert(early.emitCollect(EE::CollectAll(), std::vector<int>(), 3).size() == left, "emitCollect: should still reach them");
+#endif
+	}, "CollectingEventEmitter - emitCollect with reducers");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		ExampleDeferredEventEmitterImpl queue;
+		EE::InlineExecutor inlineExecutor;
+		std::string order;
+		test.onExample(queue, [&](int, int, std::string str) {
+			order += "q1" + str;
+		});
+		test.onExample([&](int, int, std::string str) {
+			order += "d" + str;
+		});
+		test.onExample(queue, [&](int, int, std::string str) {
+			order += "q2" + str;
+		});
+		test.onExample(inlineExecutor, [&](int, int, std::string str) {
+			order += "i" + str;
+		});
+		test.triggerExample(0, 0, "A");
+		assert(order == "dAiA", "bound handlers should only run on their executor");
+		assert(queue.drainReady() == 1, "handlers bound to one executor should be posted as one batch");
+		assert(order == "dAiAq1Aq2A", "batched handlers should run in registration order");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleThreadedEventEmitterImpl threaded;
+		EE::ThreadPool pool(2);
+		std::atomic<int> ran(0);
+		std::thread::id id;
+		threaded.onExample(pool, [&](int a, int, std::string) {
+			id = std::this_thread::get_id();
+			ran += a;
+		});
+		threaded.onExample(threaded, [&](int a, int, std::string) {
+			ran += a * 10;
+		});
+		threaded.triggerExample(1, 0, "B");
+		while(ran < 1) {
+			std::this_thread::yield();
+		}
+		assert(id != std::this_thread::get_id(), "pool handler should run on a pool thread");
+		threaded.runAllDeferred();
+		assert(ran == 11, "handler bound to the emitter's own queue should run from runDeferred");
+#endif
+	}, "EventEmitter - handlers bound to executors");
+	runTest([] {
+		EE::TimerService timers;
+		auto later = EE::TimerService::Clock::now() + std::chrono::hours(2);
+		ExampleEventEmitterImpl source;
+		EE::Throttle<int, int, std::string> throttle(std::chrono::hours(1), timers);
+		std::string throttled;
+		throttle.on([&](int a, int, std::string str) {
+			throttled += str + std::to_string(a);
+		});
+		source.onExample(throttle.input());
+		source.triggerExample(1, 0, "A");
+		source.triggerExample(2, 0, "B");
+		source.triggerExample(3, 0, "C");
+		assert(throttled == "A1", "throttle should pass the first event at once");
+		assert(timers.advance(later) == 1 && throttled == "A1C3", "throttle should pass the last dropped event at the end of the interval");
+		assert(timers.advance(later) == 0, "throttle should not rearm without events");
+
+		EE::Debounce<int> debounce(std::chrono::hours(1), timers);
+		EE::Sample<int> sample(std::chrono::hours(1), timers);
+		EE::BufferTime<int> buffer(std::chrono::hours(1), timers);
+		std::vector<int> debounced, sampled;
+		size_t batches = 0, buffered = 0;
+		debounce.on([&](int a) {
+			debounced.push_back(a);
+		});
+		sample.on([&](int a) {
+			sampled.push_back(a);
+		});
+		buffer.on([&](const std::vector<std::tuple<int>>& batch) {
+			batches++;
+			buffered += batch.size();
+		});
+		for(int i = 0; i < 3; i++) {
+			debounce.push(i);
+			sample.push(i);
+			buffer.push(i);
+		}
+		assert(debounced.empty() && sampled.empty() && batches == 0, "operators should wait for their timers");
+		assert(timers.advance(later) == 3, "one timer per operator should be pending");
+		assert(debounced == std::vector<int>{2} && sampled == std::vector<int>{2}, "debounce and sample should pass the latest event");
+		assert(batches == 1 && buffered == 3, "bufferTime should pass all events as one batch");
+		assert(timers.advance(later + std::chrono::hours(2)) == 0, "operators should not fire without new events");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		EE::TimerService ticking;
+		EE::Throttle<int, int, std::string> racing(std::chrono::microseconds(20), ticking);
+		std::atomic<int> received(0), torn(0);
+		std::atomic<bool> done(false);
+		racing.on([&](int a, int, std::string str) {
+			received++;
+			if(str != std::to_string(a)) {
+				torn++;
+			}
+		});
+		std::thread ticker([&] {
+			while(!done) {
+				ticking.advance();
+			}
+		});
+		for(int i = 0; i < 20000; i++) {
+			racing.push(i, 0, std::to_string(i));
+			if(i % 100 == 0) {
+				racing.removeHandler(racing.on([](int, int, std::string) {}));
+			}
+		}
+		done = true;
+		ticker.join();
+		assert(received > 0 && torn == 0, "throttle should emit from the timer and from push without mixing up events");
+#endif
+	}, "EventEmitter - throttle, debounce, sample, bufferTime");
+	runTest([] {
+		ExampleLockedEventEmitterTpl<EE::NullLock, int> single;
+		int sum = 0;
+		auto handle = single.onExample([&](int a) {
+			sum += a;
+		});
+		single.onceExample([&](int a) {
+			sum += a * 10;
+		});
+		single.triggerExample(1);
+		single.triggerExample(2);
+		assert(sum == 13 && single.countExampleHandlers() == 1, "NullLock emitter should behave like a plain one");
+		assert(single.removeExampleHandler(handle) && !single.hasExampleHandlers(), "NullLock emitter should remove handlers");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleLockedEventEmitterTpl<EE::SharedLock, int> shared;
+		ExampleLockedEventEmitterTpl<EE::SpinLock, int> spin;
+		std::atomic<int> inside(0), overlapped(0), total(0);
+		shared.onExample([&](int a) {
+			if(++inside > 1) {
+				overlapped++;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			inside--;
+			total += a;
+		});
+		spin.onExample([&](int a) {
+			total += a;
+		});
+		std::vector<std::thread> threads;
+		for(int i = 0; i < 4; i++) {
+			threads.emplace_back([&] {
+				shared.triggerExample(1);
+				for(int j = 0; j < 1000; j++) {
+					spin.triggerExample(1);
+				}
+			});
+		}
+		for(auto& t : threads) {
+			t.join();
+		}
+		assert(total == 4004, "every trigger should reach the handlers");
+		assert(overlapped > 0, "SharedLock triggers should run concurrently");
+		shared.onceExample([&](int a) {
+			total += a;
+		});
+		shared.triggerExample(1);
+		shared.triggerExample(1);
+		assert(total == 4007, "once handlers should still be removed under SharedLock");
+#endif
+	}, "LockedEventEmitter - lock policies");
+	runTest([] {
+		ExampleStaticEventEmitterImpl test;
+		staticCalls.clear();
+		assert(test.hasExampleHandlers() && test.countExampleHandlers() == 2, "static handlers should be counted");
+		test.triggerExample(1, 0, "X");
+		assert(staticCalls == "m1aX", "static handlers should run in order");
+		auto handle = test.onExample([](int a, int, std::string) {
+			staticCalls += "d" + std::to_string(a);
+		});
+		test.triggerExample(2, 0, "Y");
+		assert(staticCalls == "m1aXm2aYd2", "dynamic handlers should run after the static ones");
+		assert(test.countExampleHandlers() == 3, "dynamic handlers should be counted too");
+		test.removeExampleHandler(handle);
+		test.triggerExample(3, 0, "Z");
+		assert(staticCalls == "m1aXm2aYd2m3aZ", "removed dynamic handlers should not run");
+	}, "StaticEventEmitter - static and dynamic handlers");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		EE::FilterIndex<int, int, int, std::string> byFirst([](int a, int, const std::string&) {
+			return a;
+		});
+		std::string calls;
+		test.onExample([&](int a, int, std::string) {
+			calls += "u";
+		});
+		test.onExample(byFirst.equals(1), [&](int a, int, std::string str) {
+			calls += "e1" + str;
+		});
+		auto two = test.onExample(byFirst.equals(2), [&](int a, int, std::string str) {
+			calls += "e2" + str;
+		});
+		test.onExample(byFirst.between(2, 5), [&](int a, int, std::string str) {
+			calls += "r25" + str;
+		});
+		test.onExample(byFirst.between(0, 1), [&](int a, int, std::string str) {
+			calls += "r01" + str;
+		});
+		assert(byFirst.count() == 4 && test.countExampleHandlers() == 2, "filtered handlers should live in the index, hooked up once");
+		test.triggerExample(1, 0, "A");
+		test.triggerExample(2, 0, "B");
+		test.triggerExample(5, 0, "C");
+		test.triggerExample(7, 0, "D");
+		assert(calls == "ue1Ar01Aue2Br25Bur25Cu", "only matching handlers should run");
+		assert(byFirst.remove(two) && !byFirst.remove(two), "filtered handlers should be removable once");
+		calls.clear();
+		test.triggerExample(2, 0, "E");
+		assert(calls == "ur25E", "removed filtered handlers should not run");
+	}, "EventEmitter - filtered subscriptions");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		EE::FilterIndex<int, int, int, std::string> byFirst([](int a, int, const std::string&) {
+			return a;
+		});
+		std::string calls;
+		ExampleEventEmitterImpl::Handle later = 0, doomed = 0;
+		test.onExample(byFirst.equals(1), [&](int a, int, std::string str) {
+			calls += "a" + str;
+			if(str == "A") {
+				test.triggerExample(1, 0, "N");
+				later = test.onExample(byFirst.equals(1), [&](int a, int, std::string str) {
+					calls += "l" + str;
+				});
+				byFirst.remove(doomed);
+			}
+		});
+		doomed = test.onExample(byFirst.between(0, 3), [&](int a, int, std::string str) {
+			calls += "d" + str;
+		});
+		test.triggerExample(1, 0, "A");
+		assert(calls == "aAaNdN", "subscriptions and removals inside a filtered handler should wait for the next trigger");
+		assert(byFirst.count() == 2 && !byFirst.remove(doomed), "a removal during a trigger should count at once");
+		calls.clear();
+		test.triggerExample(1, 0, "B");
+		assert(calls == "aBlB", "subscriptions made during a trigger should run on the next one");
+		assert(byFirst.remove(later) && byFirst.count() == 1, "handlers filed after a trigger should be removable");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleThreadedEventEmitterImpl first, second;
+		EE::FilterIndex<int, int, int, std::string> shared([](int a, int, const std::string&) {
+			return a;
+		});
+		int runs = 0;
+		first.onExample(shared.equals(1), [&](int a, int, std::string str) {
+			runs++;
+			if(str == "A") {
+				shared.on(shared.equals(2), [&](int, int, std::string) {
+					runs += 10;
+				});
+				second.triggerExample(2, 0, "B");
+			}
+		});
+		second.onExample(shared.equals(3), [&](int, int, std::string) {
+			runs += 100;
+		});
+		first.triggerExample(1, 0, "A");
+		assert(runs == 11, "a threaded filtered handler should be able to change the index and trigger through it again");
+#endif
+	}, "EventEmitter - filtered handlers changing the index");
+	runTest([] {
+		EE::FilterIndex<int, int, int, std::string> byFirst([](int a, int, const std::string&) {
+			return a;
+		});
+		int runs = 0;
+		{
+			ExampleEventEmitterImpl test;
+			test.onExample(byFirst.equals(1), [&](int, int, std::string) {
+				runs++;
+			});
+			test.removeAllExampleHandlers();
+			test.onExample(byFirst.equals(1), [&](int, int, std::string) {
+				runs += 10;
+			});
+			assert(test.countExampleHandlers() == 1, "the index should be attached again, once");
+			test.triggerExample(1, 0, "A");
+			assert(runs == 11, "filtered handlers should run after the emitter dropped the index");
+		}
+		ExampleEventEmitterImpl reused;
+		reused.onExample(byFirst.equals(2), [&](int, int, std::string) {
+			runs += 100;
+		});
+		reused.triggerExample(2, 0, "B");
+		assert(runs == 111, "an emitter should get the index even where another one lived before");
+	}, "EventEmitter - attaching a filter index again");
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		EE::FilterIndex<int, int, int, std::string> byFirst([](int a, int, const std::string&) {
+			return a;
+		});
+		std::string calls;
+		test.onExample(byFirst.equals(1), [&](int, int, std::string) {
+			calls += "a";
+			throw std::runtime_error("a");
+		});
+		test.onExample(byFirst.between(0, 2), [&](int, int, std::string) {
+			calls += "b";
+			throw std::runtime_error("b");
+		});
+		test.onExample(byFirst.between(1, 1), [&](int, int, std::string) {
+			calls += "c";
+		});
+		test.onExample([&](int, int, std::string) {
+			calls += "u";
+			throw std::runtime_error("u");
+		});
+		test.setExampleErrorPolicy(EE::ErrorPolicy::Aggregate);
+		size_t caught = 0;
+		try {
+			test.triggerExample(1, 0, "A");
+		} catch(EE::HandlerErrors& e) {
+			caught = e.errors.size();
+		}
+		assert(calls == "abcu" && caught == 3, "every filtered handler should run, each exception aggregated on its own");
+		std::string routed;
+		test.setExampleErrorPolicy(EE::ErrorPolicy::Route, [&](std::exception_ptr error) {
+			try {
+				std::rethrow_exception(error);
+			} catch(std::runtime_error& e) {
+				routed += e.what();
+			}
+		});
+		test.triggerExample(1, 0, "B");
+		assert(routed == "abu", "each filtered handler exception should be routed");
+		test.setExampleErrorPolicy(EE::ErrorPolicy::Propagate);
+		routed.clear();
+		try {
+			test.triggerExample(2, 0, "C");
+		} catch(std::runtime_error& e) {
+			routed = e.what();
+		}
+		assert(routed == "b", "propagate should rethrow the first exception");
+	}, "EventEmitter - filtered handlers throwing");
+	runTest([] {
+		ExampleStickyEventEmitterTpl<2, int, int, std::string> test;
+		std::string calls;
+		test.triggerExample(1, 0, "A");
+		test.triggerExample(2, 0, "B");
+		test.triggerExample(3, 0, "C");
+		test.onExample([&](int a, int, std::string str) {
+			calls += str;
+		});
+		assert(calls == "BC", "a late subscriber should get the kept history, oldest first");
+		auto spent = test.onceExample([&](int a, int, std::string str) {
+			calls += "o" + str;
+		});
+		assert(calls == "BCoC" && test.countExampleHandlers() == 1, "a late once handler should get the latest event only");
+		assert(spent == 0 && !test.removeExampleHandler(spent), "a once handler used up by the replay should not get a handle");
+		test.triggerExample(4, 0, "D");
+		assert(calls == "BCoCD", "live events should follow");
+		std::tuple<int, int, std::string> last;
+		assert(test.lastExample(last) && std::get<2>(last) == "D", "last should be the latest event");
+
+		ExampleStickyEventDispatcherTpl<ExampleEventEmitterTpl, 1, std::string, int> dispatcher;
+		int price = 0;
+		dispatcher.triggerExample("AAPL", 10);
+		dispatcher.triggerExample("MSFT", 20);
+		dispatcher.triggerExample("AAPL", 11);
+		dispatcher.onExample("AAPL", [&](int p) {
+			price = p;
+		});
+		assert(price == 11, "a late subscriber should get the last event of its key");
+		auto used = dispatcher.onceExample("MSFT", [&](int p) {
+			price = p;
+		});
+		assert(price == 20 && !dispatcher.hasExampleHandlers("MSFT") && used == 0, "a late once handler should be used up by the replay");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleStickyThreadedEventEmitterTpl<1, int, int> threaded;
+		std::atomic<bool> done(false);
+		std::thread writer([&] {
+			for(int i = 0; i < 100000; i++) {
+				threaded.triggerExample(i, 2 * i);
+			}
+			done = true;
+		});
+		bool consistent = true;
+		std::tuple<int, int> pair;
+		while(!done) {
+			if(threaded.lastExample(pair) && std::get<1>(pair) != 2 * std::get<0>(pair)) {
+				consistent = false;
+			}
+		}
+		writer.join();
+		assert(consistent, "readers should never see a torn event");
+		threaded.onExample([&](int a, int) {
+			std::get<0>(pair) = a;
+		});
+		assert(std::get<0>(pair) == 99999, "a late threaded subscriber should get the latest event");
+
+		ExampleStickyThreadedEventEmitterTpl<2, std::string> strings;
+		done = false;
+		std::thread stringWriter([&] {
+			for(int i = 0; i < 20000; i++) {
+				strings.triggerExample(std::string(1 + i % 64, 'a' + i % 26));
+			}
+			done = true;
+		});
+		std::tuple<std::string> text;
+		while(!done) {
+			if(strings.lastExample(text) && std::get<0>(text).find_first_not_of(std::get<0>(text)[0]) != std::string::npos) {
+				consistent = false;
+			}
+		}
+		stringWriter.join();
+		assert(consistent, "readers should never see a torn string");
+#endif
+	}, "StickyEventEmitter - replay to late subscribers");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+	runTest([] {
+		for(auto wait : {EE::WaitStrategy::Park, EE::WaitStrategy::BusyPoll}) {
+			EE::Pipeline pipeline;
+			auto& parse = pipeline.stage<std::string>(8, wait);
+			auto& enrich = pipeline.stage<int>(8, wait);
+			auto& publish = pipeline.stage<int, int>(8, wait);
+			std::atomic<long long> sum(0);
+			std::thread::id parseThread, publishThread;
+			parse.on([&](const std::string& raw) {
+				parseThread = std::this_thread::get_id();
+				enrich.push(std::stoi(raw));
+			});
+			enrich.on([&](int value) {
+				publish.push(value, value * 2);
+			});
+			publish.on([&](int value, int doubled) {
+				publishThread = std::this_thread::get_id();
+				sum += doubled - value;
+			});
+			pipeline.start();
+			for(int i = 1; i <= 1000; i++) {
+				parse.push(std::to_string(i));
+			}
+			pipeline.stop();
+			assert(sum == 500500, "every event should pass all stages");
+			assert(parseThread != publishThread && publishThread != std::this_thread::get_id(), "stages should run on their own threads");
+			auto metrics = pipeline.metrics();
+			assert(metrics.size() == 3 && metrics[2].processed == 1000 && metrics[0].occupancy == 0 && metrics[0].capacity == 8, "metrics should count processed events");
+		}
+	}, "Pipeline - stages over SPSC rings");
+#endif
 	runTest([] {
 		int counter1 = 0, counter2 = 0;
 		ExampleDeferredEventEmitterImpl test;
@@ -147,6 +904,109 @@ int main()
 		assert(counter1 == 16, "removeAllHandlers should have removed handler");
 		
 	}, "EventDeferredEmitter - on, once, trigger, removeAllHandlers");
+	
+	runTest([] {
+		ExampleDeferredEventEmitterImpl test;
+		std::string order;
+		test.onExample([&](int, int, std::string str) {
+			order += str;
+		});
+		test.triggerExample(0, 0, "a");
+		test.triggerExample(0, 0, "b");
+		test.triggerExampleWithPriority(EE::Priority::Low, 0, 0, "z");
+		test.triggerExampleWithPriority(EE::Priority::Critical, 0, 0, "X");
+		test.triggerExampleWithPriority(EE::Priority::Critical, 0, 0, "Y");
+		test.runDeferred();
+		test.triggerExampleWithPriority(EE::Priority::High, 0, 0, "H");
+		test.runAllDeferred();
+		assert(order == "XYHabz", "urgent deferred events should jump ahead, FIFO within a band");
+	}, "EventDeferredEmitter - deferred priority");
+	runTest([] {
+		ExampleDeferredEventEmitterImpl test;
+		int runs = 0;
+		// every event queues the next one, runAllDeferred would never return
+		test.onExample([&](int a, int b, std::string str) {
+			runs++;
+			test.triggerExample(a + 1, b, str);
+		});
+		for(int i = 0; i < 3; i++) {
+			test.triggerExample(0, 0, "");
+		}
+		assert(test.pendingDeferred() == 3, "three events should be queued");
+		EE::DrainResult result = test.runDeferredN(5);
+		assert(result.processed == 5 && result.more && runs == 5, "runDeferredN should stop after n calls");
+		result = test.runDeferredN(100, EE::DrainMode::Snapshot);
+		assert(result.processed == 3 && result.more && runs == 8, "snapshot should leave events queued meanwhile");
+		result = test.runDeferredFor(std::chrono::milliseconds(5), EE::DrainMode::UntilEmpty, 4);
+		assert(result.processed > 0 && result.more, "runDeferredFor should stop when the budget is spent");
+		assert(test.pendingDeferred() == 3, "each event should have been replaced by its successor");
+		test.removeAllExampleHandlers();
+		result = test.runDeferredFor(std::chrono::seconds(1));
+		assert(result.processed == 3 && !result.more, "runDeferredFor should return once the queue is empty");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleThreadedEventEmitterImpl threaded;
+		int last = 0;
+		threaded.onExample([&](int a, int b, std::string str) {
+			last = a;
+			if(a < 3) {
+				threaded.deferExample(a + 1, b, str);
+			}
+		});
+		threaded.triggerExample(0, 0, "");
+		result = threaded.runDeferredN(10);
+		assert(result.processed == 3 && !result.more && last == 3, "threaded handlers should be able to defer on their own emitter");
+#endif
+	}, "EventDeferredEmitter - runDeferredN, runDeferredFor");
+	runTest([] {
+		ExampleDeferredEventEmitterImpl test;
+		std::string calls;
+		test.onExample([&](int a, int b, std::string str) {
+			calls += str;
+		});
+		auto start = std::chrono::steady_clock::now();
+		test.triggerExampleAfter(std::chrono::milliseconds(40), 0, 0, "C");
+		test.triggerExampleAt(start + std::chrono::milliseconds(20), 0, 0, "B");
+		auto cancelled = test.triggerExampleAfter(std::chrono::milliseconds(20), 0, 0, "X");
+		test.triggerExampleAfter(std::chrono::milliseconds(-1), 0, 0, "A");
+		assert(test.scheduledDeferred() == 3 && test.pendingDeferred() == 1, "past events should be queued right away");
+		assert(test.cancelDeferred(cancelled) && !test.cancelDeferred(cancelled), "a timer should be cancelled once");
+		test.runAllDeferred();
+		assert(calls == "A", "timers should not fire early");
+		while(test.scheduledDeferred()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			test.runAllDeferred();
+		}
+		assert(calls == "ABC" && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(40), "timers should fire in order once due");
+
+		ExampleDeferredEventDispatcherImpl dispatcher;
+		dispatcher.onExample("retry", [&](int a, int, std::string str) {
+			calls += str;
+		});
+		assert(!dispatcher.triggerExampleAfter(std::chrono::milliseconds(1), "nobody", 0, 0, "N"), "dispatchers should not schedule names without handlers");
+		dispatcher.triggerExampleAfter(std::chrono::milliseconds(1), "retry", 0, 0, "R");
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		dispatcher.runAllDeferred();
+		assert(calls == "ABCR", "a delayed dispatcher event should reach its name");
+
+		// timers a full turn of the wheel ahead stay where they are
+		auto handle = test.triggerExampleAfter(std::chrono::seconds(10), 0, 0, "L");
+		test.runAllDeferred();
+		assert(test.scheduledDeferred() == 1 && test.cancelDeferred(handle) && calls == "ABCR", "far timers should wait");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleThreadedEventEmitterImpl threaded;
+		threaded.onExample([&](int a, int b, std::string str) {
+			calls += str;
+		});
+		threaded.deferExampleAfter(std::chrono::milliseconds(5), 0, 0, "T");
+		std::thread([&] {
+			while(threaded.scheduledDeferred()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				threaded.runAllDeferred();
+			}
+		}).join();
+		assert(calls == "ABCRT", "threaded emitters should defer to a time as well");
+#endif
+	}, "EventDeferredEmitter - triggerAfter, triggerAt, cancelDeferred");
 		
 	runTest([]{
 		ExampleEventDispatcherImpl dispatcher;
@@ -197,8 +1057,638 @@ int main()
 		assert(sum == 16, "should run second callback");
 		
 	}, "EventDeferredDispatcher - on, trigger, runDeferred");
+	runTest([]{
+		ExampleDeferredEventDispatcherImpl dispatcher;
+		std::string calls;
+		dispatcher.triggerExample("early", 1, 0, "E");
+		assert(dispatcher.pendingDeferred() == 0, "events without subscribers should not be queued");
+		dispatcher.onExample("quote", [&](int a, int, std::string str) {
+			calls += str + std::to_string(a);
+		});
+		dispatcher.onceExample("quote", [&](int a, int, std::string str) {
+			calls += "o";
+		});
+		dispatcher.triggerExample("quote", 1, 0, "Q");
+		dispatcher.triggerExample("trade", 2, 0, "T");
+		dispatcher.triggerExampleWithPriority(EE::Priority::High, std::string("quote"), 3, 0, "H");
+		assert(dispatcher.pendingDeferred() == 2, "only events with subscribers should be queued");
+		dispatcher.runAllDeferred();
+		assert(calls == "H3oQ1", "queued events should reach their buckets in priority order");
+		dispatcher.removeAllExampleHandlers("quote");
+		dispatcher.triggerExample("quote", 4, 0, "R");
+		assert(dispatcher.pendingDeferred() == 0 && !dispatcher.hasExampleHandlers("quote"), "events should be dropped once a name loses its handlers");
+	}, "EventDeferredDispatcher - interned names, dropping unsubscribed events");
+	runTest([]{
+		ExampleDeferredEventDispatcherImpl dispatcher;
+		std::string calls;
+		handle_id_type second = 0;
+		dispatcher.onExample("tick", [&](int a, int, std::string) {
+			calls += "a" + std::to_string(a);
+			// enough subscriptions to grow the bucket under this call
+			for(int i = 0;i < 16;i++) {
+				dispatcher.onExample("tick", [&](int, int, std::string) {
+					calls += "n";
+				});
+			}
+			dispatcher.removeExampleHandler("tick", second);
+		});
+		second = dispatcher.onExample("tick", [&](int, int, std::string) {
+			calls += "b";
+		});
+		dispatcher.onExample("tick", [&](int a, int, std::string) {
+			calls += "c" + std::to_string(a);
+		});
+		dispatcher.triggerExample("tick", 1, 0, "");
+		dispatcher.runAllDeferred();
+		assert(calls == "a1c1", "handlers added during a dispatch should wait, removed ones should not run nor shift the others");
+		assert(dispatcher.countExampleHandlers("tick") == 18, "handlers added during a dispatch should be kept");
+		dispatcher.removeAllExampleHandlers("tick");
+		dispatcher.onceExample("tick", [&](int, int, std::string) {
+			calls += "o";
+			dispatcher.onceExample("tick", [&](int, int, std::string) {
+				calls += "p";
+			});
+		});
+		dispatcher.triggerExample("tick", 2, 0, "");
+		dispatcher.runAllDeferred();
+		dispatcher.triggerExample("tick", 3, 0, "");
+		dispatcher.runAllDeferred();
+		assert(calls == "a1c1op" && !dispatcher.hasExampleHandlers("tick"), "once handlers may resubscribe during a dispatch");
+	}, "EventDeferredDispatcher - subscribing and removing during dispatch");
+	runTest([]{
+		int made = 0;
+		auto make = [&] {
+			made++;
+			return std::make_tuple(made, 0, std::string("L"));
+		};
+		ExampleEventEmitterImpl test;
+		test.emitExampleLazy(make);
+		assert(made == 0, "the factory should not run without handlers");
+		std::string calls;
+		auto handle = test.onceExample([&](int a, int, std::string str) {
+			calls += str + std::to_string(a);
+		});
+		test.emitExampleLazy(make);
+		test.emitExampleLazy(make);
+		assert(made == 1 && calls == "L1", "the factory should run only while a handler is left");
+		assert(!test.removeExampleHandler(handle) && !test.hasExampleHandlers(), "a used up once handler should not count");
+
+		ExampleStickyEventEmitterTpl<1, int, int, std::string> sticky;
+		sticky.emitExampleLazy(make);
+		std::tuple<int, int, std::string> last;
+		assert(made == 2 && sticky.lastExample(last), "a sticky emitter should always keep the event");
+
+		ExampleEventDispatcherImpl dispatcher;
+		ExampleDeferredEventDispatcherImpl deferred;
+		dispatcher.onExample("quote", [&](int a, int, std::string str) {
+			calls += "d" + std::to_string(a);
+		});
+		deferred.onExample("quote", [&](int a, int, std::string str) {
+			calls += "q" + std::to_string(a);
+		});
+		dispatcher.emitExampleLazy("trade", make);
+		deferred.emitExampleLazy("trade", make);
+		assert(made == 2, "the factory should not run for names without handlers");
+		dispatcher.emitExampleLazy("quote", make);
+		deferred.emitExampleLazy("quote", make);
+		deferred.runAllDeferred();
+		assert(made == 4 && calls == "L1d3q4", "the factory should run for names with handlers");
+
+		ConnectionEvents events;
+		events.emitLazy<Connect>([&] {
+			return ++made;
+		});
+		events.on<Connect>([&](int fd) {
+			calls += "c" + std::to_string(fd);
+		});
+		events.emitLazy<Connect>([&] {
+			return ++made;
+		});
+		assert(made == 5 && calls == "L1d3q4c5", "a single argument should be passed as is");
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		ExampleThreadedEventEmitterImpl threaded;
+		int before = made;
+		std::atomic<int> received(0);
+		std::thread subscriber([&] {
+			threaded.onExample([&](int, int, std::string) {
+				received++;
+			});
+		});
+		while(!threaded.hasExampleHandlers()) {
+			threaded.emitExampleLazy(make);
+		}
+		subscriber.join();
+		threaded.emitExampleLazy(make);
+		assert(received >= 1 && made - before == received, "the factory should run exactly for the events a concurrently subscribed handler got");
+#endif
+	}, "EventEmitter - emitLazy");
 	
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		auto pair = EE::Future<std::tuple<int, int, std::string>>::create();
+		test.onceExample(pair.first);
+		int result = 0;
+		auto chained = std::move(pair.second).then([](std::tuple<int, int, std::string> t) {
+			return std::get<0>(t) * std::get<1>(t);
+		}).then([&](int product) {
+			result = product;
+		});
+		assert(result == 0, "then: should not run before trigger");
+		test.triggerExample(6, 7, "A");
+		assert(result == 42, "then: continuations should run inline on trigger");
+		assert(chained.ready(), "then: chained future should be ready");
+		
+		auto broken = EE::Future<int>::create();
+		{
+			auto promise = std::move(broken.first);
+		}
+		bool thrown = false;
+		try {
+			broken.second.get();
+		} catch(EE::BrokenPromise&) {
+			thrown = true;
+		}
+		assert(thrown, "get: should throw when promise is destroyed unset");
+	}, "Future - then, broken promise");
+	runTest([] {
+		ConnectionEvents events;
+		int connected = 0, received = 0, closed = 0;
+		assert(!events.hasHandlers<Data>(), "hasHandlers: should be false before subscribing");
+		events.trigger<Close>();
+		events.on<Connect>([&](int fd) {
+			connected = fd;
+		});
+		auto handle = events.on<Data>([&](std::string data, int len) {
+			received += len;
+		});
+		events.once<Close>([&] {
+			closed++;
+		});
+		events.trigger<Connect>(3);
+		events.trigger<Data>("ab", 2);
+		assert(connected == 3 && received == 2, "trigger: should only reach the handlers of that event");
+		events.defer<Data>("cde", 3);
+		events.defer<Close>();
+		events.defer<Close>();
+		assert(received == 2 && closed == 0, "defer: should not run before runDeferred");
+		events.runAllDeferred();
+		assert(received == 5 && closed == 1, "defer: should share one queue for all events");
+		assert(events.removeHandler<Data>(handle), "removeHandler: should find the handler");
+		events.trigger<Data>("f", 1);
+		assert(received == 5, "removeHandler: should not run after removal");
+		assert(events.countHandlers<Connect>() == 1, "countHandlers: should count per event");
+		events.removeAllHandlers();
+		assert(!events.hasHandlers<Connect>(), "removeAllHandlers: should clear every event");
+		events.on<Connect>([&](int fd) {
+			connected = fd;
+		});
+		events.trigger<Connect>(4);
+		assert(connected == 4 && events.countHandlers<Connect>() == 1, "on: the embedded tables should be reused after removeAllHandlers");
+	}, "EventSet - on, trigger, defer");
+
+#ifdef __EVENTEMITTER_HAS_COROUTINES
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		int sum = 0, resumed = 0;
+		auto task = [&]() -> DetachedTask {
+			auto t = co_await test.nextExample();
+			sum += std::get<0>(t) + std::get<1>(t);
+			resumed++;
+			auto u = co_await test.nextExample();
+			sum += std::get<0>(u) + std::get<1>(u);
+			resumed++;
+		};
+		task();
+		assert(resumed == 0, "should be suspended until trigger");
+		test.triggerExample(1, 2, "A");
+		assert(resumed == 1 && sum == 3, "first trigger should resume inline");
+		test.triggerExample(3, 4, "B");
+		assert(resumed == 2 && sum == 10, "second trigger should resume second await");
+		test.triggerExample(5, 6, "C");
+		assert(resumed == 2 && sum == 10, "finished coroutine should not be resumed");
+	}, "EventEmitter - co_await next");
+
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		std::string seen;
+		auto task = [&]() -> DetachedTask {
+			auto events = test.streamExample();
+			for(int i = 0;i < 3;++i) {
+				auto t = co_await events.next();
+				seen += std::get<2>(t);
+			}
+		};
+		test.triggerExample(0, 0, "X");
+		task();
+		test.triggerExample(0, 0, "A");
+		test.triggerExample(0, 0, "B");
+		test.triggerExample(0, 0, "C");
+		test.triggerExample(0, 0, "D");
+		assert(seen == "ABC", "stream should yield every event after creation until destroyed");
+
+		seen.clear();
+		auto slow = test.streamExample(nullptr, 2);
+		test.triggerExample(0, 0, "1");
+		test.triggerExample(0, 0, "2");
+		test.triggerExample(0, 0, "3");
+		test.triggerExample(0, 0, "4");
+		assert(slow.pending() == 2 && slow.lost() == 2, "a full stream should overwrite its oldest events and count them");
+		auto drain = [&]() -> DetachedTask {
+			for(int i = 0;i < 2;++i) {
+				auto t = co_await slow.next();
+				seen += std::get<2>(t);
+			}
+		};
+		drain();
+		assert(seen == "34" && slow.pending() == 0, "a stream should yield the newest events it kept in order");
+		test.triggerExample(0, 0, "5");
+		assert(slow.pending() == 1 && slow.lost() == 2, "a drained stream should buffer again");
+	}, "EventEmitter - co_await stream");
+
+	runTest([] {
+		ExampleEventEmitterImpl test;
+		ExampleDeferredEventEmitterImpl executor;
+		bool resumed = false;
+		auto task = [&]() -> DetachedTask {
+			co_await test.nextExample(&executor);
+			resumed = true;
+		};
+		task();
+		test.triggerExample(1, 1, "A");
+		assert(!resumed, "should not resume inline with an executor");
+		executor.runAllDeferred();
+		assert(resumed, "should resume when executor is drained");
+
+		std::string seen;
+		auto consume = [&]() -> DetachedTask {
+			auto events = test.streamExample(&executor);
+			for(int i = 0;i < 3;++i) {
+				auto t = co_await events.next();
+				seen += std::get<2>(t);
+			}
+		};
+		consume();
+		test.triggerExample(0, 0, "B");
+		test.triggerExample(0, 0, "C");
+		assert(seen.empty() && executor.pendingDeferred() == 1, "a stream should queue one resume however many events arrive");
+		executor.runAllDeferred();
+		assert(seen == "BC", "the resumed stream should consume what it buffered");
+		test.triggerExample(0, 0, "D");
+		executor.runAllDeferred();
+		assert(seen == "BCD", "a stream should be resumed on the executor again");
+	}, "EventEmitter - co_await next on executor");
+#endif
+
+	runTest([] {
+		ExampleDeferredEventEmitterImpl executor;
+		std::string calls;
+		struct Call : EE::DeferredBase::Resumable {
+			std::string* calls;
+			char name;
+		};
+		Call a, b;
+		a.calls = b.calls = &calls;
+		a.name = 'a';
+		b.name = 'b';
+		a.run = b.run = [](EE::DeferredBase::Resumable* r) {
+			Call* call = static_cast<Call*>(r);
+			*call->calls += call->name;
+		};
+		executor.post([&] {
+			calls += "f";
+		});
+		executor.post(a);
+		executor.post(b);
+		executor.post(a);
+		assert(executor.pendingDeferred() == 3, "a resumable should be queued once at a time");
+		assert(executor.withdraw(b) && !executor.withdraw(b), "a queued resumable should be withdrawn once");
+		executor.runAllDeferred();
+		assert(calls == "af", "resumables should run ahead of queued calls");
+		executor.post(b);
+		executor.clearDeferred();
+		executor.post(b);
+		executor.runAllDeferred();
+		assert(calls == "afb", "a cleared resumable should be posted again");
+	}, "DeferredEventEmitter - posting resumables");
+
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+	runTest([] {
+		ExampleDeferredEventEmitterImpl test;
+		int sum = 0;
+		test.onExample([&](int a, int b, std::string str) {
+			sum += a + b;
+		});
+		pollfd pfd = { test.readinessFd(), POLLIN, 0 };
+		assert(poll(&pfd, 1, 0) == 0, "should not be readable while queue is empty");
+		test.triggerExample(1, 2, "A");
+		test.triggerExample(3, 4, "B");
+		assert(poll(&pfd, 1, 0) == 1, "should be readable after trigger");
+		uint64_t signals = 0;
+		assert(read(pfd.fd, &signals, sizeof(signals)) == sizeof(signals) && signals == 1, "should signal only on empty to non-empty transition");
+		assert(test.drainReady() == 2, "drainReady should run all deferred");
+		assert(sum == 10, "handlers should have run");
+		assert(poll(&pfd, 1, 0) == 0, "should not be readable after drain");
+		test.triggerExample(1, 0, "C");
+		test.triggerExample(1, 0, "D");
+		assert(read(pfd.fd, &signals, sizeof(signals)) == sizeof(signals), "should signal the first event");
+		EE::DrainResult result = test.runDeferredN(1);
+		assert(result.more && poll(&pfd, 1, 0) == 1, "a drain leaving work behind should signal again");
+		assert(read(pfd.fd, &signals, sizeof(signals)) == sizeof(signals), "read");
+		result = test.runDeferredFor(std::chrono::seconds(1), EE::DrainMode::UntilEmpty, 0);
+		assert(result.processed == 1 && !result.more && poll(&pfd, 1, 0) == 0 && sum == 12, "checking the clock every 0 calls should mean every call");
+	}, "EventDeferredEmitter - readinessFd");
+	runTest([]{
+		EE::EventSource source;
+		ExampleEventEmitterImpl readable;
+		ExampleDeferredEventEmitterImpl queue;
+		int fds[2];
+		assert(pipe(fds) == 0, "pipe");
+		std::string calls;
+		readable.onExample([&](int fd, int events, std::string) {
+			char c;
+			while(read(fd, &c, 1) == 1) {
+				calls += c;
+			}
+		});
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		auto watched = source.watch(fds[0], EPOLLIN, [&](int fd, uint32_t events) {
+			readable.triggerExample(fd, static_cast<int>(events), "");
+		});
+		assert(source.poll(0) == 0, "nothing should be ready");
+		assert(write(fds[1], "ab", 2) == 2, "write");
+		assert(source.poll(100) == 1 && calls == "ab", "readiness should trigger the emitter inline");
+
+		int ticks = 0;
+		auto timer = source.addTimer(std::chrono::milliseconds(1), [&](uint64_t expirations) {
+			ticks += static_cast<int>(expirations);
+		}, &queue);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		source.poll(100);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		source.poll(100);
+		assert(queue.pendingDeferred() == 1, "timer expirations should be coalesced into one queued call");
+		queue.runAllDeferred();
+		assert(ticks >= 5, "queued call should get every expiration");
+		assert(source.remove(timer) && !source.remove(timer), "timers should be removable once");
+
+		int signalled = 0;
+		source.addSignals({SIGUSR1}, [&](int signal) {
+			signalled = signal;
+		});
+		raise(SIGUSR1);
+		assert(source.poll(100) == 1 && signalled == SIGUSR1, "signals should arrive through the loop");
+
+		// a watched fd closed without remove() and its number reused
+		int stale[2], fresh[2];
+		assert(pipe(stale) == 0, "pipe");
+		auto staleHandle = source.watch(stale[0], EPOLLIN, [&](int, uint32_t) {
+			calls += "s";
+		});
+		close(stale[0]);
+		close(stale[1]);
+		assert(pipe(fresh) == 0 && fresh[0] == stale[0], "the fd number should be reused");
+		source.watch(fresh[0], EPOLLIN, [&](int fd, uint32_t) {
+			char c;
+			while(read(fd, &c, 1) == 1) {
+				calls += "f";
+			}
+		});
+		fcntl(fresh[0], F_SETFL, O_NONBLOCK);
+		assert(source.remove(staleHandle), "the stale source should still be removable");
+		assert(write(fresh[1], "x", 1) == 1, "write");
+		assert(source.poll(100) == 1 && calls == "abf", "removing a stale source should not drop the fd that reused its number");
+		close(fresh[0]);
+		close(fresh[1]);
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		std::atomic<bool> seen(false);
+		std::thread::id loop;
+		source.remove(watched);
+		source.watch(fds[0], EPOLLIN, [&](int fd, uint32_t) {
+			char c;
+			while(read(fd, &c, 1) == 1);
+			loop = std::this_thread::get_id();
+			seen = true;
+		});
+		source.start();
+		assert(write(fds[1], "c", 1) == 1, "write");
+		while(!seen) {
+			std::this_thread::yield();
+		}
+		source.stop();
+		assert(loop != std::this_thread::get_id(), "handlers should run on the loop thread");
+#endif
+		close(fds[0]);
+		close(fds[1]);
+	}, "EventSource - fds, timers and signals");
+#endif
+
+#ifdef __EVENTEMITTER_HAS_SHM
+	runTest([] {
+		const char* name = "/eventemitter-test";
+		EE::SharedRing::unlink(name);
+		ExampleSharedMemoryEventEmitterImpl receiver(name, 1024);
+		long sum = 0;
+		int count = 0;
+		receiver.onExample([&](int a, int b, double c) {
+			sum += a + b;
+			count++;
+		});
+		const int events = 500;
+		pid_t child = fork();
+		if(child == 0) {
+			ExampleSharedMemoryEventEmitterImpl sender(name);
+			for(int i = 0;i < events;++i) {
+				sender.triggerExample(i, 1, 0.5);
+			}
+			_exit(0);
+		}
+		while(count < events) {
+			if(!receiver.receiveExample(std::chrono::seconds(5))) {
+				break;
+			}
+		}
+		int status = 0;
+		waitpid(child, &status, 0);
+		EE::SharedRing::unlink(name);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "sender process should exit cleanly");
+		assert(count == events, "every event should cross the process boundary");
+		assert(sum == (long)events * (events - 1) / 2 + events, "arguments should arrive intact");
+		assert(receiver.lostExampleEvents() == 0, "no events should be lost");
+	}, "SharedMemoryEventEmitter - trigger in another process");
+
+	runTest([] {
+		const char* name = "/eventemitter-test-overrun";
+		EE::SharedRing::unlink(name);
+		ExampleSharedMemoryEventEmitterImpl test(name, 8);
+		int count = 0;
+		test.onExample([&](int, int, double) {
+			count++;
+		});
+		for(int i = 0;i < 20;++i) {
+			test.triggerExample(i, 0, 0.0);
+		}
+		test.receiveExample();
+		EE::SharedRing::unlink(name);
+		assert(count == 8 && test.lostExampleEvents() == 12, "slow readers should skip to the oldest event and count lost ones");
+	}, "SharedMemoryEventEmitter - overrun");
+#endif
+
+#ifdef __EVENTEMITTER_HAS_EVENTLOG
+	runTest([] {
+		const char* path = "/tmp/eventemitter-test.log";
+		{
+			EE::EventLog log(path);
+			ExampleEventEmitterImpl first, second;
+			first.onExample(log.recorder<int, int, std::string>(1));
+			second.onExample(log.recorder<int, int, std::string>(2));
+			for(int i = 0;i < 10000;++i) {
+				first.triggerExample(i, 1, "first");
+				if(i % 100 == 0) {
+					second.triggerExample(i, 2, std::string(i / 10, 'x'));
+				}
+			}
+#ifndef EVENTEMITTER_DISABLE_THREADING
+			std::thread([&] {
+				for(int i = 0;i < 1000;++i) {
+					first.triggerExample(-1, 0, "thread");
+				}
+				log.flush();
+			}).join();
+#endif
+			assert(log.dropped() == 0, "nothing should be dropped");
+		}
+		
+		ExampleEventEmitterImpl replayed;
+		long firstSum = 0, threadCount = 0, secondSize = 0;
+		replayed.onExample([&](int a, int b, std::string str) {
+			if(str == "thread") {
+				threadCount++;
+			}
+			else {
+				firstSum += a + b;
+			}
+		});
+		EE::EventReplayer replayer(path);
+		replayer.route<int, int, std::string>(1, [&](int a, int b, std::string str) {
+			replayed.triggerExample(a, b, str);
+		});
+		replayer.route<int, int, std::string>(2, [&](int a, int b, std::string str) {
+			secondSize += str.size();
+		});
+		size_t count = replayer.replay(0);
+		remove(path);
+#ifndef EVENTEMITTER_DISABLE_THREADING
+		assert(count == 11100 && threadCount == 1000, "all events from all threads should be replayed");
+#else
+		assert(count == 10100, "all events should be replayed");
+#endif
+		assert(firstSum == 10000L * 9999 / 2 + 10000, "arguments should be replayed intact");
+		assert(secondSize == 49500, "strings should be replayed intact");
+	}, "EventLog - record and replay");
+
+	runTest([] {
+		const char* path = "/tmp/eventemitter-test-timing.log";
+		{
+			EE::EventLog log(path);
+			ExampleEventEmitterImpl test;
+			test.onExample(log.recorder<int, int, std::string>(7));
+			test.triggerExample(1, 0, "");
+			std::this_thread::sleep_for(std::chrono::milliseconds(40));
+			test.triggerExample(2, 0, "");
+		}
+		EE::EventReplayer replayer(path);
+		std::vector<std::chrono::steady_clock::time_point> times;
+		replayer.route<int, int, std::string>(7, [&](int, int, std::string) {
+			times.push_back(std::chrono::steady_clock::now());
+		});
+		replayer.replay(2.0);
+		remove(path);
+		assert(times.size() == 2, "both events should be replayed");
+		auto gap = std::chrono::duration_cast<std::chrono::milliseconds>(times[1] - times[0]).count();
+		assert(gap >= 18 && gap < 40, "replay at double speed should halve the gaps");
+	}, "EventLog - accelerated replay");
+
+	runTest([] {
+		const char* paths[] = { "/tmp/eventemitter-test-a.log", "/tmp/eventemitter-test-b.log", "/tmp/eventemitter-test-c.log" };
+		{
+			EE::EventLog a(paths[0]);
+			{
+				EE::EventLog b(paths[1]);
+				for(int i = 0;i < 1000;++i) {
+					a.record(1, i);
+					b.record(2, -i);
+				}
+			}
+			// takes the slot b left behind, the stale entry must not match
+			EE::EventLog c(paths[2]);
+			for(int i = 0;i < 10;++i) {
+				c.record(3, i);
+				a.record(1, 1000 + i);
+			}
+		}
+		long sums[3] = { 0, 0, 0 };
+		size_t counts[3];
+		for(int l = 0;l < 3;++l) {
+			EE::EventReplayer replayer(paths[l]);
+			for(uint32_t id = 1;id <= 3;++id) {
+				replayer.route<int>(id, [&, id](int v) {
+					sums[l] += v;
+					assert(id == uint32_t(l + 1), "events should land in the log they were recorded to");
+				});
+			}
+			counts[l] = replayer.replay(0);
+			remove(paths[l]);
+		}
+		assert(counts[0] == 1010 && counts[1] == 1000 && counts[2] == 10, "every log should keep its own events");
+		assert(sums[0] == 1009L * 1010 / 2 && sums[1] == -999L * 1000 / 2 && sums[2] == 45, "events written to logs in turn should stay intact");
+	}, "EventLog - one thread writing to several logs");
+#endif
+
 #ifndef	EVENTEMITTER_DISABLE_THREADING
+#ifdef __EVENTEMITTER_HAS_EVENTFD
+	runTest([] {
+		ExampleDeferredEventEmitterImpl first, second;
+		std::thread::id id;
+		int count = 0;
+		first.onExample([&](int, int, std::string) {
+			id = std::this_thread::get_id();
+			count++;
+		});
+		second.onExample([&](int, int, std::string) {
+			count++;
+		});
+		EE::DeferredPoller poller;
+		poller.add(first);
+		poller.add(second);
+		std::thread([&] {
+			first.triggerExample(1, 1, "A");
+			first.triggerExample(1, 1, "A");
+			second.triggerExample(1, 1, "A");
+		}).join();
+		size_t drained = 0;
+		while(drained < 3) {
+			drained += poller.poll(1000);
+		}
+		assert(count == 3 && id == std::this_thread::get_id(), "should drain on polling thread");
+		assert(poller.poll(0) == 0, "should have nothing left");
+
+		auto start = std::chrono::steady_clock::now();
+		assert(second.nextDeadline() == std::chrono::steady_clock::time_point::max(), "no timer should mean no deadline");
+		second.triggerExampleAfter(std::chrono::milliseconds(20), 1, 1, "T");
+		auto due = second.nextDeadline();
+		assert(due >= start + std::chrono::milliseconds(20) && due <= start + std::chrono::milliseconds(22), "the deadline should be the timer rounded up to a tick");
+		assert(poller.poll(5000) == 1 && count == 4, "the poller should wake for a timer");
+		assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(2), "the poller should not sleep past the timer");
+
+		second.triggerExampleAfter(std::chrono::milliseconds(5), 1, 1, "T");
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		pollfd ready{second.readinessFd(), POLLIN, 0};
+		assert(::poll(&ready, 1, 0) == 0, "a due timer should not signal on its own");
+		assert(second.nextDeadline() == std::chrono::steady_clock::time_point::max() && ::poll(&ready, 1, 0) == 1, "nextDeadline should queue due timers and signal readiness");
+		assert(second.drainReady() == 1 && count == 5, "the due timer should run from the queue");
+	}, "EventDeferredEmitter - DeferredPoller");
+#endif
+
 	runTest([] {
 		auto test = std::make_shared<ExampleDeferredEventEmitterImpl>();
 		
@@ -222,6 +1712,18 @@ int main()
 		assert(std::get<2>(t) == "B", "Should got 3rd argument");
 			
 	}, "EventThreadedEmitter - futureOnce");
+
+	runTest([]{
+		ExampleThreadedEventEmitterImpl test;
+		auto future = test.futureOnceExample();
+		assert(future.wait_for(std::chrono::milliseconds(1)) == std::future_status::timeout, "Should not be ready before trigger");
+		std::thread([&] {
+			test.triggerExample(1, 2, "C");
+		}).join();
+		assert(future.wait_for(std::chrono::milliseconds(1)) == std::future_status::ready, "Should be ready after trigger");
+		assert(std::get<2>(future.get()) == "C", "Should got 3rd argument");
+		assert(!test.hasExampleHandlers(), "once handler should be gone");
+	}, "EventThreadedEmitter - futureOnce from thread");
 	
 	
 	runTest([]{
@@ -270,6 +1772,54 @@ int main()
 		while(!async) {}
 		assert(id != std::this_thread::get_id(), "async properly run");
 	}, "EventThreadedEmitter - asyncOnce and defer");
+	runTest([] {
+		ExampleThreadedEventEmitterImpl test;
+		std::atomic<bool> done(false);
+		std::atomic<int> calls(0);
+		std::thread trigger([&] {
+			while(!done) {
+				test.triggerExample(1, 0, "T");
+			}
+		});
+		for(int i = 0;i < 2000;i++) {
+			if(i % 100 == 0) {
+				test.setExampleErrorPolicy(EE::ErrorPolicy::Aggregate);
+			}
+			auto handle = test.onExample([&](int, int, std::string) {
+				calls++;
+			});
+			test.onceExample([&](int, int, std::string) {
+				calls++;
+			});
+			test.removeExampleHandler(handle);
+			if(i % 10 == 0) {
+				test.removeAllExampleHandlers();
+			}
+		}
+		done = true;
+		trigger.join();
+		test.removeAllExampleHandlers();
+		assert(!test.hasExampleHandlers(), "removals racing triggers should leave a consistent list");
+	}, "EventThreadedEmitter - remove and set the error policy while triggering");
+
+#ifdef __EVENTEMITTER_HAS_COROUTINES
+	runTest([]{
+		ExampleThreadedEventEmitterImpl test;
+		std::atomic<int> value(0);
+		std::thread::id id;
+		auto task = [&]() -> DetachedTask {
+			auto t = co_await test.nextExample();
+			id = std::this_thread::get_id();
+			value = std::get<0>(t);
+		};
+		task();
+		std::thread([&] {
+			test.triggerExample(42, 0, "T");
+		}).join();
+		assert(value == 42, "should receive value from the triggering thread");
+		assert(id != std::this_thread::get_id(), "should resume on the triggering thread");
+	}, "EventThreadedEmitter - co_await next from thread");
+#endif
 	
 #endif
 	